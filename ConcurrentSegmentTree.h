@@ -0,0 +1,151 @@
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+/* Segment tree that may be shared between threads. Positions are split into
+ * shards, each an iterative bottom-up tree guarded by a seqlock, with a small
+ * top tree over the shard totals. Readers never take a lock: they retry a
+ * shard (or the top tree) if a writer changed it while they were reading.
+ * Writers lock only the shard they touch and then briefly the top tree, so
+ * writers to different shards proceed in parallel. Each query sees every
+ * shard it reads at a single point in time. T must be trivially copyable. */
+template<typename T, typename Merge = std::plus<T>>
+class ConcurrentSegmentTree
+{
+    class Tree
+    {
+    public:
+        void assign(const T* a, int size, const Merge& f)
+        {
+            n = size;
+            st = std::vector<std::atomic<T>>(n * 2);
+            for (int i = 0; i < n; ++i) {
+                st[n + i].store(a[i], std::memory_order_relaxed);
+            }
+            for (int p = n - 1; p > 0; --p) pull(p, f);
+            seq.store(0, std::memory_order_release);
+        }
+
+        T query(int i, int j, const Merge& f) const
+        {
+            for (;;) {
+                unsigned s = seq.load(std::memory_order_acquire);
+                if (s & 1) continue;
+                T ret = read(i, j, f);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq.load(std::memory_order_relaxed) == s) return ret;
+            }
+        }
+
+        void update(int i, const T& v, const Merge& f)
+        {
+            unsigned s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            st[i + n].store(v, std::memory_order_relaxed);
+            for (int p = (i + n) >> 1; p > 0; p >>= 1) pull(p, f);
+            seq.store(s + 2, std::memory_order_release);
+        }
+
+        int size() const { return n; }
+
+        std::mutex lock;
+
+    private:
+        void pull(int p, const Merge& f)
+        {
+            st[p].store(f(st[p << 1].load(std::memory_order_relaxed),
+                          st[p << 1 | 1].load(std::memory_order_relaxed)),
+                        std::memory_order_relaxed);
+        }
+
+        T read(int i, int j, const Merge& f) const
+        {
+            bool has1 = false, has2 = false;
+            T v1 = T(), v2 = T();
+            for (int l = i + n, r = j + n + 1; l < r; l >>= 1, r >>= 1) {
+                if (l & 1) {
+                    T v = st[l++].load(std::memory_order_relaxed);
+                    v1 = has1 ? f(v1, v) : v;
+                    has1 = true;
+                }
+                if (r & 1) {
+                    T v = st[--r].load(std::memory_order_relaxed);
+                    v2 = has2 ? f(v, v2) : v;
+                    has2 = true;
+                }
+            }
+            if (!has1) return v2;
+            if (!has2) return v1;
+            return f(v1, v2);
+        }
+
+        int n;
+        std::vector<std::atomic<T>> st;
+        std::atomic<unsigned> seq;
+    };
+
+public:
+    template<typename Container>
+    explicit ConcurrentSegmentTree(const Container& a,
+                                   const Merge& merge = Merge(),
+                                   int shards = 64)
+        : f(merge)
+    {
+        std::vector<T> v(a.begin(), a.end());
+        init(v, shards);
+    }
+
+    template<typename InputIt>
+    ConcurrentSegmentTree(InputIt first, InputIt last,
+                          const Merge& merge = Merge(), int shards = 64)
+        : f(merge)
+    {
+        std::vector<T> v(first, last);
+        init(v, shards);
+    }
+
+    T query(int i, int j) const
+    {
+        int si = i / w, sj = j / w;
+        if (si == sj) return sh[si].query(i - si * w, j - si * w, f);
+        T ret = sh[si].query(i - si * w, sh[si].size() - 1, f);
+        if (si + 1 < sj) ret = f(ret, top.query(si + 1, sj - 1, f));
+        return f(ret, sh[sj].query(0, j - sj * w, f));
+    }
+
+    void update(int i, const T& v)
+    {
+        int s = i / w;
+        {
+            std::lock_guard<std::mutex> guard(sh[s].lock);
+            sh[s].update(i - s * w, v, f);
+        }
+        std::lock_guard<std::mutex> guard(top.lock);
+        top.update(s, sh[s].query(0, sh[s].size() - 1, f), f);
+    }
+
+private:
+    void init(const std::vector<T>& v, int shards)
+    {
+        int n = v.size();
+        shards = std::max(shards, 1);
+        w = (n + shards - 1) / shards;
+        int k = (n + w - 1) / w;
+        sh = std::vector<Tree>(k);
+        std::vector<T> totals(k);
+        for (int s = 0; s < k; ++s) {
+            int size = std::min(w, n - s * w);
+            sh[s].assign(&v[s * w], size, f);
+            totals[s] = sh[s].query(0, size - 1, f);
+        }
+        top.assign(&totals[0], k, f);
+    }
+
+    int w;
+    std::vector<Tree> sh;
+    Tree top;
+    Merge f;
+};
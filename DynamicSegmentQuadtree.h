@@ -0,0 +1,234 @@
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace dynamic_segment_quadtree_detail {
+
+/* Narrows [L, R] x [T, B] to its quadrant k (top-left, top-right,
+ * bottom-left, bottom-right), returning false if it does not exist. */
+inline bool quadrant(int k, long long& L, long long& T,
+                     long long& R, long long& B)
+{
+    if (k & 1) {
+        if (L == R) return false;
+        L = L + (R - L) / 2 + 1;
+    } else {
+        R = L + (R - L) / 2;
+    }
+    if (k & 2) {
+        if (T == B) return false;
+        T = T + (B - T) / 2 + 1;
+    } else {
+        B = T + (B - T) / 2;
+    }
+    return true;
+}
+
+inline int depth(long long nx, long long ny)
+{
+    int depth = 1;
+    while ((1LL << (depth - 1)) < nx || (1LL << (depth - 1)) < ny) ++depth;
+    return depth;
+}
+
+} // namespace dynamic_segment_quadtree_detail
+
+/* Quadtree over [0, nx) x [0, ny) for very large domains (up to 2^62 per
+ * side) where nodes are only created when a cell below them is first
+ * updated. Nodes live in one contiguous pool and refer to their children by
+ * 32-bit index, 0 meaning absent. The comparator version only considers
+ * updated cells and returns (-1, -1) for a rectangle without any; the merge
+ * version treats untouched cells as identity. */
+template<typename E, typename Function = std::less<E>, bool merge = false>
+class DynamicSegmentQuadtree;
+
+template<typename E, typename Compare>
+class DynamicSegmentQuadtree<E, Compare, false>
+{
+    struct Node
+    {
+        E value;
+        long long x;
+        long long y;
+        std::uint32_t child[4];
+    };
+
+public:
+    DynamicSegmentQuadtree(long long nx, long long ny,
+                           const Compare& compare = Compare())
+        : nx(nx), ny(ny), nodes(1, Node{E(), -1, -1, {0, 0, 0, 0}}),
+          f(compare) {}
+
+    std::pair<long long, long long> query(long long x1, long long y1,
+                                          long long x2, long long y2) const
+    {
+        if (nodes[0].x < 0) return {-1, -1};
+        const Node* p = query(0, 0, 0, nx - 1, ny - 1, x1, y1, x2, y2);
+        if (!p) return {-1, -1};
+        return {p->x, p->y};
+    }
+
+    void update(long long x, long long y, const E& v)
+    {
+        update(0, 0, 0, nx - 1, ny - 1, x, y, v);
+    }
+
+    void reserve(int positions)
+    {
+        nodes.reserve(nodes.size() + static_cast<std::size_t>(positions) *
+                      dynamic_segment_quadtree_detail::depth(nx, ny));
+    }
+
+private:
+    std::uint32_t create()
+    {
+        nodes.push_back(Node{E(), -1, -1, {0, 0, 0, 0}});
+        return nodes.size() - 1;
+    }
+
+    const Node* query(std::uint32_t p, long long L, long long T,
+                      long long R, long long B, long long x1, long long y1,
+                      long long x2, long long y2) const
+    {
+        if (L >= x1 && R <= x2 && T >= y1 && B <= y2) return &nodes[p];
+        const Node* ret = nullptr;
+        for (int k = 0; k < 4; ++k) {
+            std::uint32_t c = nodes[p].child[k];
+            long long l = L, t = T, r = R, b = B;
+            if (!c) continue;
+            dynamic_segment_quadtree_detail::quadrant(k, l, t, r, b);
+            if (r < x1 || l > x2 || b < y1 || t > y2) continue;
+            const Node* n = query(c, l, t, r, b, x1, y1, x2, y2);
+            if (n && (!ret || f(n->value, ret->value))) ret = n;
+        }
+        return ret;
+    }
+
+    void update(std::uint32_t p, long long L, long long T,
+                long long R, long long B, long long x, long long y,
+                const E& v)
+    {
+        if (L == R && T == B) {
+            nodes[p].value = v;
+            nodes[p].x = x;
+            nodes[p].y = y;
+            return;
+        }
+        for (int k = 0; k < 4; ++k) {
+            long long l = L, t = T, r = R, b = B;
+            if (!dynamic_segment_quadtree_detail::quadrant(k, l, t, r, b)) {
+                continue;
+            }
+            if (x < l || x > r || y < t || y > b) continue;
+            if (!nodes[p].child[k]) {
+                std::uint32_t c = create();
+                nodes[p].child[k] = c;
+            }
+            update(nodes[p].child[k], l, t, r, b, x, y, v);
+            break;
+        }
+        std::uint32_t best = 0;
+        for (int k = 0; k < 4; ++k) {
+            std::uint32_t c = nodes[p].child[k];
+            if (c && (!best || f(nodes[c].value, nodes[best].value))) best = c;
+        }
+        nodes[p].value = nodes[best].value;
+        nodes[p].x = nodes[best].x;
+        nodes[p].y = nodes[best].y;
+    }
+
+    long long nx, ny;
+    std::vector<Node> nodes;
+    Compare f;
+};
+
+template<typename E, typename Merge>
+class DynamicSegmentQuadtree<E, Merge, true>
+{
+    struct Node
+    {
+        E value;
+        std::uint32_t child[4];
+    };
+
+public:
+    DynamicSegmentQuadtree(long long nx, long long ny, E identity = E(),
+                           const Merge& merge = Merge())
+        : nx(nx), ny(ny), nodes(1, Node{identity, {0, 0, 0, 0}}),
+          id(identity), f(merge) {}
+
+    E query(long long x1, long long y1, long long x2, long long y2) const
+    {
+        return query(0, 0, 0, nx - 1, ny - 1, x1, y1, x2, y2);
+    }
+
+    void update(long long x, long long y, const E& v)
+    {
+        update(0, 0, 0, nx - 1, ny - 1, x, y, v);
+    }
+
+    void reserve(int positions)
+    {
+        nodes.reserve(nodes.size() + static_cast<std::size_t>(positions) *
+                      dynamic_segment_quadtree_detail::depth(nx, ny));
+    }
+
+private:
+    std::uint32_t create()
+    {
+        nodes.push_back(Node{id, {0, 0, 0, 0}});
+        return nodes.size() - 1;
+    }
+
+    E query(std::uint32_t p, long long L, long long T, long long R,
+            long long B, long long x1, long long y1,
+            long long x2, long long y2) const
+    {
+        if (L >= x1 && R <= x2 && T >= y1 && B <= y2) return nodes[p].value;
+        E ret = id;
+        for (int k = 0; k < 4; ++k) {
+            std::uint32_t c = nodes[p].child[k];
+            long long l = L, t = T, r = R, b = B;
+            if (!c) continue;
+            dynamic_segment_quadtree_detail::quadrant(k, l, t, r, b);
+            if (r < x1 || l > x2 || b < y1 || t > y2) continue;
+            ret = f(ret, query(c, l, t, r, b, x1, y1, x2, y2));
+        }
+        return ret;
+    }
+
+    void update(std::uint32_t p, long long L, long long T, long long R,
+                long long B, long long x, long long y, const E& v)
+    {
+        if (L == R && T == B) {
+            nodes[p].value = v;
+            return;
+        }
+        for (int k = 0; k < 4; ++k) {
+            long long l = L, t = T, r = R, b = B;
+            if (!dynamic_segment_quadtree_detail::quadrant(k, l, t, r, b)) {
+                continue;
+            }
+            if (x < l || x > r || y < t || y > b) continue;
+            if (!nodes[p].child[k]) {
+                std::uint32_t c = create();
+                nodes[p].child[k] = c;
+            }
+            update(nodes[p].child[k], l, t, r, b, x, y, v);
+            break;
+        }
+        E value = id;
+        for (int k = 0; k < 4; ++k) {
+            std::uint32_t c = nodes[p].child[k];
+            if (c) value = f(value, nodes[c].value);
+        }
+        nodes[p].value = value;
+    }
+
+    long long nx, ny;
+    std::vector<Node> nodes;
+    E id;
+    Merge f;
+};
@@ -0,0 +1,95 @@
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/* Segment tree over positions [0, n) for very large n (up to 2^62) where
+ * nodes are only created when a position below them is first updated.
+ * Untouched positions hold identity. Nodes live in one contiguous pool and
+ * refer to their children by 32-bit index, 0 meaning absent. */
+template<typename T, typename Merge = std::plus<T>>
+class DynamicSegmentTree
+{
+    struct Node
+    {
+        T value;
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+
+public:
+    explicit DynamicSegmentTree(long long n, T identity = T(),
+                                const Merge& merge = Merge())
+        : n(n), nodes(1, Node{identity, 0, 0}), id(identity), f(merge) {}
+
+    T query(long long i, long long j) const
+    {
+        return query(0, 0, n - 1, i, j);
+    }
+
+    void update(long long i, const T& v)
+    {
+        update(0, 0, n - 1, i, v);
+    }
+
+    void reserve(int positions)
+    {
+        int depth = 1;
+        while ((1LL << (depth - 1)) < n) ++depth;
+        nodes.reserve(nodes.size() + static_cast<std::size_t>(positions) * depth);
+    }
+
+private:
+    const T& value(std::uint32_t p) const { return p ? nodes[p].value : id; }
+
+    std::uint32_t create()
+    {
+        nodes.push_back({id, 0, 0});
+        return nodes.size() - 1;
+    }
+
+    T query(std::uint32_t p, long long L, long long R,
+            long long i, long long j) const
+    {
+        if (L >= i && R <= j) return nodes[p].value;
+        long long M = L + (R - L) / 2;
+        std::uint32_t l = nodes[p].left, r = nodes[p].right;
+        if (j < M + 1) {
+            return l ? query(l, L, M, i, j) : id;
+        } else if (i > M) {
+            return r ? query(r, M + 1, R, i, j) : id;
+        } else {
+            return f(l ? query(l, L, M, i, j) : id,
+                     r ? query(r, M + 1, R, i, j) : id);
+        }
+    }
+
+    void update(std::uint32_t p, long long L, long long R,
+                long long i, const T& v)
+    {
+        if (L == R) {
+            nodes[p].value = v;
+        } else {
+            long long M = L + (R - L) / 2;
+            if (i > M) {
+                if (!nodes[p].right) {
+                    std::uint32_t c = create();
+                    nodes[p].right = c;
+                }
+                update(nodes[p].right, M + 1, R, i, v);
+            } else {
+                if (!nodes[p].left) {
+                    std::uint32_t c = create();
+                    nodes[p].left = c;
+                }
+                update(nodes[p].left, L, M, i, v);
+            }
+            nodes[p].value = f(value(nodes[p].left), value(nodes[p].right));
+        }
+    }
+
+    long long n;
+    std::vector<Node> nodes;
+    T id;
+    Merge f;
+};
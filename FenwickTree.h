@@ -48,3 +48,57 @@ private:
     BinaryOperation f;
     InverseOperation f_i;
 };
+
+/* Range add, range sum Fenwick tree on [1, n] built from two interleaved
+ * trees: adding v to [a, b] adds v and -v at a and b + 1 to the first and
+ * v (a - 1) and -v b to the second, and the prefix sum up to k is then
+ * first(k) k - second(k). T needs +, - and * by an index. */
+template<typename T>
+class FenwickTreeRangeUpdate
+{
+    struct Node
+    {
+        T mul;
+        T add;
+    };
+
+public:
+    explicit FenwickTreeRangeUpdate(int n) : ft(n + 1, Node{T(), T()}) {}
+
+    T query(int b) const
+    {
+        T mul = T(), add = T();
+        for (int k = b; k; k -= k & -k) {
+            mul += ft[k].mul;
+            add += ft[k].add;
+        }
+        return mul * static_cast<T>(b) - add;
+    }
+
+    T query(int a, int b) const
+    {
+        if (a == 1) return query(b);
+        return query(b) - query(a - 1);
+    }
+
+    void adjust(int a, int b, T v)
+    {
+        update(a, v, v * static_cast<T>(a - 1));
+        update(b + 1, -v, -v * static_cast<T>(b));
+    }
+
+    void adjust(int k, T v) { adjust(k, k, v); }
+
+    T getSingle(int k) const { return query(k, k); }
+
+private:
+    void update(int k, T mul, T add)
+    {
+        for (; k < static_cast<int>(ft.size()); k += k & -k) {
+            ft[k].mul += mul;
+            ft[k].add += add;
+        }
+    }
+
+    std::vector<Node> ft;
+};
@@ -47,3 +47,75 @@ private:
     BinaryOperation f;
     InverseOperation f_i;
 };
+
+/* Rectangle add, rectangle sum Fenwick tree on [1, nx] x [1, ny] built
+ * from four interleaved trees. Adding v at corner (x, y) adds v, v (x - 1),
+ * v (y - 1) and v (x - 1)(y - 1) to them, so that the prefix sum up to
+ * (x, y) is a x y - b y - c x + d. T needs +, - and * by an index. */
+template<typename T>
+class FenwickTree2DRangeUpdate
+{
+    struct Node
+    {
+        T a;
+        T b;
+        T c;
+        T d;
+    };
+
+public:
+    FenwickTree2DRangeUpdate(int nx, int ny)
+        : ft(ny + 1, std::vector<Node>(nx + 1, Node{T(), T(), T(), T()})) {}
+
+    T query(int x, int y) const
+    {
+        T a = T(), b = T(), c = T(), d = T();
+        for (int y1 = y; y1; y1 -= y1 & -y1) {
+            for (int x1 = x; x1; x1 -= x1 & -x1) {
+                const Node& n = ft[y1][x1];
+                a += n.a;
+                b += n.b;
+                c += n.c;
+                d += n.d;
+            }
+        }
+        T tx = static_cast<T>(x), ty = static_cast<T>(y);
+        return a * tx * ty - b * ty - c * tx + d;
+    }
+
+    T query(int x1, int y1, int x2, int y2) const
+    {
+        return query(x2, y2) - query(x1 - 1, y2) - query(x2, y1 - 1) +
+               query(x1 - 1, y1 - 1);
+    }
+
+    void adjust(int x1, int y1, int x2, int y2, T v)
+    {
+        update(x1, y1, v);
+        update(x2 + 1, y1, -v);
+        update(x1, y2 + 1, -v);
+        update(x2 + 1, y2 + 1, v);
+    }
+
+    void adjust(int x, int y, T v) { adjust(x, y, x, y, v); }
+
+private:
+    /* Adds v to every cell (x', y') with x' >= x and y' >= y. */
+    void update(int x, int y, T v)
+    {
+        T b = v * static_cast<T>(x - 1), c = v * static_cast<T>(y - 1);
+        T d = b * static_cast<T>(y - 1);
+        for (; y < static_cast<int>(ft.size()); y += y & -y) {
+            for (int x1 = x; x1 < static_cast<int>(ft[0].size());
+                 x1 += x1 & -x1) {
+                Node& n = ft[y][x1];
+                n.a += v;
+                n.b += b;
+                n.c += c;
+                n.d += d;
+            }
+        }
+    }
+
+    std::vector<std::vector<Node>> ft;
+};
@@ -0,0 +1,172 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+/* Quadtree over a 2D grid with lazy propagation of rectangle updates.
+ * merge(x, y) combines adjacent rectangles, apply(x, u, area) applies update
+ * u to the aggregate x of area cells and compose(u2, u1) returns the update
+ * equivalent to applying u1 then u2. apply must distribute over merge. */
+template<typename E, typename U, typename Merge, typename Apply,
+         typename Compose = std::plus<U>,
+         typename Container = std::vector<std::vector<E>>>
+class LazySegmentQuadtree
+{
+public:
+    LazySegmentQuadtree(const Container& a,
+                        const Merge& merge = Merge(),
+                        const Apply& apply = Apply(),
+                        const Compose& compose = Compose())
+        : nx(a[0].size()), ny(a.size()), f(merge), g(apply), h(compose)
+    {
+        int max_dim = std::max(nx, ny);
+        st.resize(max_dim * max_dim * 16 / 3);
+        lz.resize(st.size());
+        has.resize(st.size());
+        build(0, 0, 0, nx - 1, ny - 1, a);
+    }
+
+    E query(int x1, int y1, int x2, int y2) const
+    {
+        return query(0, 0, 0, nx - 1, ny - 1, x1, y1, x2, y2);
+    }
+
+    void update(int x, int y, const E& v)
+    {
+        update(0, 0, 0, nx - 1, ny - 1, x, y, v);
+    }
+
+    void update(int x1, int y1, int x2, int y2, const U& u)
+    {
+        update(0, 0, 0, nx - 1, ny - 1, x1, y1, x2, y2, u);
+    }
+
+private:
+    /* Narrows [L, R] x [T, B] to its quadrant k (top-left, top-right,
+     * bottom-left, bottom-right), returning false if it does not exist. */
+    static bool quadrant(int k, int& L, int& T, int& R, int& B)
+    {
+        if (k & 1) {
+            if (L == R) return false;
+            L = (L + R) / 2 + 1;
+        } else {
+            R = (L + R) / 2;
+        }
+        if (k & 2) {
+            if (T == B) return false;
+            T = (T + B) / 2 + 1;
+        } else {
+            B = (T + B) / 2;
+        }
+        return true;
+    }
+
+    static int child(int p, int k) { return (p << 2) + 1 + k; }
+
+    void pull(int p, int L, int T, int R, int B)
+    {
+        st[p] = st[child(p, 0)];
+        for (int k = 1; k < 4; ++k) {
+            int l = L, t = T, r = R, b = B;
+            if (quadrant(k, l, t, r, b)) st[p] = f(st[p], st[child(p, k)]);
+        }
+    }
+
+    void build(int p, int L, int T, int R, int B, const Container& a)
+    {
+        if (L == R && T == B) {
+            st[p] = a[T][L];
+        } else {
+            for (int k = 0; k < 4; ++k) {
+                int l = L, t = T, r = R, b = B;
+                if (quadrant(k, l, t, r, b)) build(child(p, k), l, t, r, b, a);
+            }
+            pull(p, L, T, R, B);
+        }
+    }
+
+    void applyNode(int p, int L, int T, int R, int B, const U& u)
+    {
+        st[p] = g(st[p], u, (R - L + 1) * (B - T + 1));
+        if (L != R || T != B) {
+            lz[p] = has[p] ? h(u, lz[p]) : u;
+            has[p] = true;
+        }
+    }
+
+    void push(int p, int L, int T, int R, int B)
+    {
+        if (has[p]) {
+            for (int k = 0; k < 4; ++k) {
+                int l = L, t = T, r = R, b = B;
+                if (quadrant(k, l, t, r, b)) {
+                    applyNode(child(p, k), l, t, r, b, lz[p]);
+                }
+            }
+            has[p] = false;
+        }
+    }
+
+    E query(int p, int L, int T, int R, int B,
+            int x1, int y1, int x2, int y2) const
+    {
+        if (L >= x1 && R <= x2 && T >= y1 && B <= y2) return st[p];
+        bool found = false;
+        E ret = E();
+        for (int k = 0; k < 4; ++k) {
+            int l = L, t = T, r = R, b = B;
+            if (!quadrant(k, l, t, r, b)) continue;
+            if (r < x1 || l > x2 || b < y1 || t > y2) continue;
+            E v = query(child(p, k), l, t, r, b, x1, y1, x2, y2);
+            ret = found ? f(ret, v) : v;
+            found = true;
+        }
+        if (has[p]) {
+            ret = g(ret, lz[p], (std::min(R, x2) - std::max(L, x1) + 1) *
+                                (std::min(B, y2) - std::max(T, y1) + 1));
+        }
+        return ret;
+    }
+
+    void update(int p, int L, int T, int R, int B, int x, int y, const E& v)
+    {
+        if (L == R && T == B) {
+            st[p] = v;
+        } else {
+            push(p, L, T, R, B);
+            for (int k = 0; k < 4; ++k) {
+                int l = L, t = T, r = R, b = B;
+                if (quadrant(k, l, t, r, b) &&
+                    x >= l && x <= r && y >= t && y <= b) {
+                    update(child(p, k), l, t, r, b, x, y, v);
+                }
+            }
+            pull(p, L, T, R, B);
+        }
+    }
+
+    void update(int p, int L, int T, int R, int B,
+                int x1, int y1, int x2, int y2, const U& u)
+    {
+        if (L >= x1 && R <= x2 && T >= y1 && B <= y2) {
+            applyNode(p, L, T, R, B, u);
+        } else {
+            push(p, L, T, R, B);
+            for (int k = 0; k < 4; ++k) {
+                int l = L, t = T, r = R, b = B;
+                if (!quadrant(k, l, t, r, b)) continue;
+                if (r < x1 || l > x2 || b < y1 || t > y2) continue;
+                update(child(p, k), l, t, r, b, x1, y1, x2, y2, u);
+            }
+            pull(p, L, T, R, B);
+        }
+    }
+
+    int nx, ny;
+    std::vector<E> st;
+    std::vector<U> lz;
+    std::vector<char> has;
+    Merge f;
+    Apply g;
+    Compose h;
+};
@@ -0,0 +1,141 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+/* Segment tree with lazy propagation of range updates.
+ * merge(x, y) combines adjacent ranges, apply(x, u, len) applies update u to
+ * the aggregate x of len elements and compose(u2, u1) returns the update
+ * equivalent to applying u1 then u2. apply must distribute over merge. */
+template<typename T, typename U, typename Merge, typename Apply,
+         typename Compose = std::plus<U>, typename Container = std::vector<T>>
+class LazySegmentTree
+{
+public:
+    LazySegmentTree(const Container& a,
+                    const Merge& merge = Merge(),
+                    const Apply& apply = Apply(),
+                    const Compose& compose = Compose())
+        : n(a.size()), st(n * 4), lz(n * 4), has(n * 4),
+          f(merge), g(apply), h(compose)
+    {
+        build(0, 0, n - 1, a);
+    }
+
+    template<typename InputIt>
+    LazySegmentTree(InputIt first, InputIt last,
+                    const Merge& merge = Merge(),
+                    const Apply& apply = Apply(),
+                    const Compose& compose = Compose())
+        : f(merge), g(apply), h(compose)
+    {
+        Container a(first, last);
+        n = a.size();
+        st.resize(n * 4);
+        lz.resize(n * 4);
+        has.resize(n * 4);
+        build(0, 0, n - 1, a);
+    }
+
+    T query(int i, int j) const { return query(0, 0, n - 1, i, j); }
+
+    void update(int i, const T& v)
+    {
+        update(0, 0, n - 1, i, v);
+    }
+
+    void update(int i, int j, const U& u)
+    {
+        update(0, 0, n - 1, i, j, u);
+    }
+
+private:
+    static int left(int p) { return (p << 1) + 1; }
+    static int right(int p) { return (p << 1) + 2; }
+
+    void build(int p, int L, int R, const Container& a)
+    {
+        if (L == R) {
+            st[p] = a[L];
+        } else {
+            build(left(p), L, (L + R) / 2, a);
+            build(right(p), (L + R) / 2 + 1, R, a);
+            st[p] = f(st[left(p)], st[right(p)]);
+        }
+    }
+
+    void applyNode(int p, int L, int R, const U& u)
+    {
+        st[p] = g(st[p], u, R - L + 1);
+        if (L != R) {
+            lz[p] = has[p] ? h(u, lz[p]) : u;
+            has[p] = true;
+        }
+    }
+
+    void push(int p, int L, int R)
+    {
+        if (has[p]) {
+            applyNode(left(p), L, (L + R) / 2, lz[p]);
+            applyNode(right(p), (L + R) / 2 + 1, R, lz[p]);
+            has[p] = false;
+        }
+    }
+
+    T query(int p, int L, int R, int i, int j) const
+    {
+        if (L >= i && R <= j) return st[p];
+        T ret;
+        if (j < (L + R) / 2 + 1) {
+            ret = query(left(p), L, (L + R) / 2, i, j);
+        } else if (i > (L + R) / 2) {
+            ret = query(right(p), (L + R) / 2 + 1, R, i, j);
+        } else {
+            ret = f(query(left(p), L, (L + R) / 2, i, j),
+                    query(right(p), (L + R) / 2 + 1, R, i, j));
+        }
+        if (has[p]) {
+            ret = g(ret, lz[p], std::min(R, j) - std::max(L, i) + 1);
+        }
+        return ret;
+    }
+
+    void update(int p, int L, int R, int i, const T& v)
+    {
+        if (L == R) {
+            st[p] = v;
+        } else {
+            push(p, L, R);
+            if (i > (L + R) / 2) {
+                update(right(p), (L + R) / 2 + 1, R, i, v);
+            } else {
+                update(left(p), L, (L + R) / 2, i, v);
+            }
+            st[p] = f(st[left(p)], st[right(p)]);
+        }
+    }
+
+    void update(int p, int L, int R, int i, int j, const U& u)
+    {
+        if (L >= i && R <= j) {
+            applyNode(p, L, R, u);
+        } else {
+            push(p, L, R);
+            if (i <= (L + R) / 2) {
+                update(left(p), L, (L + R) / 2, i, j, u);
+            }
+            if (j > (L + R) / 2) {
+                update(right(p), (L + R) / 2 + 1, R, i, j, u);
+            }
+            st[p] = f(st[left(p)], st[right(p)]);
+        }
+    }
+
+    int n;
+    std::vector<T> st;
+    std::vector<U> lz;
+    std::vector<char> has;
+    Merge f;
+    Apply g;
+    Compose h;
+};
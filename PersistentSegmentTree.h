@@ -0,0 +1,107 @@
+#include <vector>
+#include <cstddef>
+#include <functional>
+
+/* Persistent segment tree: update copies the O(log n) nodes on the path to
+ * the leaf and returns a handle to the new version, leaving every earlier
+ * version queryable. Nodes of all versions live in one contiguous pool and
+ * refer to their children by index. */
+template<typename T, typename Container = std::vector<T>,
+         typename Merge = std::plus<T>>
+class PersistentSegmentTree
+{
+    struct Node
+    {
+        T value;
+        int left;
+        int right;
+    };
+
+public:
+    PersistentSegmentTree(const Container& a,
+                          const Merge& merge = Merge())
+        : n(a.size()), f(merge)
+    {
+        nodes.reserve(2 * n);
+        roots.push_back(build(0, n - 1, a));
+    }
+
+    template<typename InputIt>
+    PersistentSegmentTree(InputIt first, InputIt last,
+                          const Merge& merge = Merge())
+        : f(merge)
+    {
+        Container a(first, last);
+        n = a.size();
+        nodes.reserve(2 * n);
+        roots.push_back(build(0, n - 1, a));
+    }
+
+    T query(int version, int i, int j) const
+    {
+        return query(roots[version], 0, n - 1, i, j);
+    }
+
+    int update(int version, int i, const T& v)
+    {
+        roots.push_back(update(roots[version], 0, n - 1, i, v));
+        return roots.size() - 1;
+    }
+
+    int getVersionCount() const { return roots.size(); }
+
+    void reserve(int updates)
+    {
+        int depth = 1;
+        while ((1 << (depth - 1)) < n) ++depth;
+        nodes.reserve(nodes.size() + static_cast<std::size_t>(updates) * depth);
+        roots.reserve(roots.size() + updates);
+    }
+
+private:
+    int build(int L, int R, const Container& a)
+    {
+        if (L == R) {
+            nodes.push_back({a[L], -1, -1});
+        } else {
+            int l = build(L, (L + R) / 2, a);
+            int r = build((L + R) / 2 + 1, R, a);
+            nodes.push_back({f(nodes[l].value, nodes[r].value), l, r});
+        }
+        return nodes.size() - 1;
+    }
+
+    T query(int p, int L, int R, int i, int j) const
+    {
+        if (L >= i && R <= j) return nodes[p].value;
+        if (j < (L + R) / 2 + 1) {
+            return query(nodes[p].left, L, (L + R) / 2, i, j);
+        } else if (i > (L + R) / 2) {
+            return query(nodes[p].right, (L + R) / 2 + 1, R, i, j);
+        } else {
+            return f(query(nodes[p].left, L, (L + R) / 2, i, j),
+                     query(nodes[p].right, (L + R) / 2 + 1, R, i, j));
+        }
+    }
+
+    int update(int p, int L, int R, int i, const T& v)
+    {
+        if (L == R) {
+            nodes.push_back({v, -1, -1});
+        } else {
+            int l = nodes[p].left, r = nodes[p].right;
+            if (i > (L + R) / 2) {
+                r = update(r, (L + R) / 2 + 1, R, i, v);
+            } else {
+                l = update(l, L, (L + R) / 2, i, v);
+            }
+            nodes.push_back({f(nodes[l].value, nodes[r].value), l, r});
+        }
+        return nodes.size() - 1;
+    }
+
+    int n;
+    std::vector<Node> nodes;
+    std::vector<int> roots;
+    Merge f;
+};
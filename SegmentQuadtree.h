@@ -1,36 +1,169 @@
 #include <vector>
+#include <algorithm>
 #include <functional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <utility>
 
+namespace segment_quadtree_detail {
+
+/* Number of threads to use for elements nodes of type Node: at most one per
+ * 1 << 14 nodes, and only one for bool, as std::vector<bool> packs nodes
+ * into shared words. */
+template<typename Node>
+int workers(int threads, long long elements)
+{
+    if (std::is_same<Node, bool>::value) return 1;
+    return std::max(1LL, std::min<long long>(threads, elements >> 14));
+}
+
+/* Runs f1(threads1) and f2(threads2) over elements nodes, on two threads
+ * when workers() allows it, splitting the thread budget between them. */
+template<typename Node, typename F1, typename F2>
+void fork_join(int threads, long long elements, F1 f1, F2 f2)
+{
+    if (workers<Node>(threads, elements) > 1) {
+        std::thread t(f1, threads / 2);
+        f2(threads - threads / 2);
+        t.join();
+    } else {
+        f1(1);
+        f2(1);
+    }
+}
+
+/* Spreads the low 16 bits of x to the even bits of the result. */
+inline int interleave(int x)
+{
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    return (x | (x << 1)) & 0x55555555;
+}
+
+/* Gathers the even bits of m into the low bits of the result. */
+inline int deinterleave(int m)
+{
+    m &= 0x55555555;
+    m = (m | (m >> 1)) & 0x33333333;
+    m = (m | (m >> 2)) & 0x0F0F0F0F;
+    m = (m | (m >> 4)) & 0x00FF00FF;
+    return (m | (m >> 8)) & 0x0000FFFF;
+}
+
+inline int morton(int x, int y) { return interleave(x) | interleave(y) << 1; }
+
+template<typename Container>
+auto at(const Container& a, std::pair<int, int> c) -> decltype(a[0][0])
+{
+    return a[c.second][c.first];
+}
+
+template<typename E>
+typename std::vector<E>::const_reference at(const std::vector<E>& v, int m)
+{
+    return v[m];
+}
+
+/* Node of a comparator tree: the cell of the best element, as an (x, y) pair
+ * into the container or a Morton code into the flat grid, and when cached a
+ * copy of its value so comparisons do not go back to the grid. */
+template<typename E, typename Cell, bool cache>
+struct comparator_node
+{
+    template<typename Grid>
+    static comparator_node make(const Grid& a, Cell c)
+    {
+        comparator_node n;
+        n.cell = c;
+        n.cached = at(a, c);
+        return n;
+    }
+
+    template<typename Grid>
+    const E& value(const Grid&) const { return cached; }
+
+    Cell cell;
+    E cached;
+};
+
+template<typename E, typename Cell>
+struct comparator_node<E, Cell, false>
+{
+    template<typename Grid>
+    static comparator_node make(const Grid&, Cell c)
+    {
+        comparator_node n;
+        n.cell = c;
+        return n;
+    }
+
+    template<typename Grid>
+    auto value(const Grid& a) const -> decltype(at(a, Cell()))
+    {
+        return at(a, cell);
+    }
+
+    Cell cell;
+};
+
+} // namespace segment_quadtree_detail
+
+/* Recursive quadtree with nodes in BFS heap order, splitting each side of a
+ * rectangle at its midpoint (at most 16/3 max_dim^2 nodes) */
+struct SegmentQuadtreeHeapLayout {};
+
+/* Quadtree over the grid padded to a power-of-two square, so that every
+ * level of the heap order is in Morton (Z) order and the grid is stored in
+ * Morton order as well: nearby cells and their ancestors share cache lines
+ * and pages (4/3 size^2 nodes). Sides longer than 2^15 throw
+ * std::length_error. */
+struct SegmentQuadtreeMortonLayout {};
+
+/* With cache set, comparator quadtrees keep a copy of the best value in every
+ * node next to its cell, so queries compare node-local data instead of
+ * loading from the grid (E must be trivially copyable). */
 template<typename E, typename Container = std::vector<std::vector<E>>,
-         typename Function = std::less<E>, bool merge = false>
+         typename Function = std::less<E>, bool merge = false,
+         typename Layout = SegmentQuadtreeHeapLayout, bool cache = false>
 class SegmentQuadtree;
 
-template<typename E, typename Container, typename Compare>
-class SegmentQuadtree<E, Container, Compare, false>
+template<typename E, typename Container, typename Compare, bool cache>
+class SegmentQuadtree<E, Container, Compare, false,
+                      SegmentQuadtreeHeapLayout, cache>
 {
+    static_assert(!cache || std::is_trivially_copyable<E>::value,
+                  "cached values require a trivially copyable E");
+
+    typedef segment_quadtree_detail::comparator_node<
+        E, std::pair<int, int>, cache> Node;
+
 public:
     SegmentQuadtree(const Container& c,
-                    const Compare& compare = Compare())
+                    const Compare& compare = Compare(),
+                    int threads = 1)
         : a(c), f(compare)
     {
         int max_dim = std::max(a[0].size(), a.size());
         st.resize(max_dim * max_dim * 16 / 3);
-        build(0, 0, 0, a[0].size() - 1, a.size() - 1);
+        build(0, 0, 0, a[0].size() - 1, a.size() - 1, threads);
     }
 
     SegmentQuadtree(Container&& c,
-                const Compare& compare = Compare())
+                const Compare& compare = Compare(),
+                int threads = 1)
         : a(std::move(c)), f(compare)
     {
         int max_dim = std::max(a[0].size(), a.size());
         st.resize(max_dim * max_dim * 16 / 3);
-        build(0, 0, 0, a[0].size() - 1, a.size() - 1);
+        build(0, 0, 0, a[0].size() - 1, a.size() - 1, threads);
     }
 
     std::pair<int, int> query(int x1, int y1, int x2, int y2) const
     {
-        return query(0, 0, 0, a[0].size() - 1, a.size() - 1, x1, y1, x2, y2);
+        return query(0, 0, 0, a[0].size() - 1, a.size() - 1,
+                     x1, y1, x2, y2).cell;
     }
 
     void update(int x, int y, const E& v)
@@ -51,44 +184,74 @@ private:
     static int bottomleft(int p) { return (p << 2) + 3; }
     static int bottomright(int p) { return (p << 2) + 4; }
 
-    void build(int p, int L, int T, int R, int B)
+    Node best(const Node& n1, const Node& n2) const
     {
+        return f(n2.value(a), n1.value(a)) ? n2 : n1;
+    }
+
+    void build(int p, int L, int T, int R, int B, int threads)
+    {
+        long long cells = static_cast<long long>(R - L + 1) * (B - T + 1);
         if (L == R) {
             if (T == B) {
-                st[p] = {L, T};
+                st[p] = Node::make(a, std::make_pair(L, T));
             } else {
-                build(topleft(p), L, T, L, (T + B) / 2);
-                build(bottomleft(p), L, (T + B) / 2 + 1, L, B);
+                segment_quadtree_detail::fork_join<Node>(threads, cells,
+                    [this, p, L, T, B](int t) {
+                        build(topleft(p), L, T, L, (T + B) / 2, t);
+                    },
+                    [this, p, L, T, B](int t) {
+                        build(bottomleft(p), L, (T + B) / 2 + 1, L, B, t);
+                    });
                 auto p1 = st[topleft(p)], p2 = st[bottomleft(p)];
-                st[p] = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                        ? p2 : p1;
+                st[p] = best(p1, p2);
             }
         } else {
             if (T == B) {
-                build(topleft(p), L, T, (L + R) / 2, T);
-                build(topright(p), (L + R) / 2 + 1, T, R, T);
+                segment_quadtree_detail::fork_join<Node>(threads, cells,
+                    [this, p, L, T, R](int t) {
+                        build(topleft(p), L, T, (L + R) / 2, T, t);
+                    },
+                    [this, p, L, T, R](int t) {
+                        build(topright(p), (L + R) / 2 + 1, T, R, T, t);
+                    });
                 auto p1 = st[topleft(p)], p2 = st[topright(p)];
-                st[p] = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                        ? p2 : p1;
+                st[p] = best(p1, p2);
             } else {
-                build(topleft(p), L, T, (L + R) / 2, (T + B) / 2);
-                build(topright(p), (L + R) / 2 + 1, T, R, (T + B) / 2);
-                build(bottomleft(p), L, (T + B) / 2 + 1, (L + R) / 2, B);
-                build(bottomright(p), (L + R) / 2 + 1, (T + B) / 2 + 1, R, B);
+                segment_quadtree_detail::fork_join<Node>(threads, cells,
+                    [this, p, L, T, R, B, cells](int t) {
+                        segment_quadtree_detail::fork_join<Node>(t, cells / 2,
+                            [this, p, L, T, R, B](int t) {
+                                build(topleft(p),
+                                      L, T, (L + R) / 2, (T + B) / 2, t);
+                            },
+                            [this, p, L, T, R, B](int t) {
+                                build(topright(p),
+                                      (L + R) / 2 + 1, T, R, (T + B) / 2, t);
+                            });
+                    },
+                    [this, p, L, T, R, B, cells](int t) {
+                        segment_quadtree_detail::fork_join<Node>(t, cells / 2,
+                            [this, p, L, T, R, B](int t) {
+                                build(bottomleft(p),
+                                      L, (T + B) / 2 + 1, (L + R) / 2, B, t);
+                            },
+                            [this, p, L, T, R, B](int t) {
+                                build(bottomright(p), (L + R) / 2 + 1,
+                                      (T + B) / 2 + 1, R, B, t);
+                            });
+                    });
                 auto p1 = st[topleft(p)], p2 = st[topright(p)],
                      p3 = st[bottomleft(p)], p4 = st[bottomright(p)];
-                auto b1 = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                          ? p2 : p1;
-                auto b2 = f(a[p4.second][p4.first], a[p3.second][p3.first])
-                          ? p4 : p3;
-                st[p] = f(a[b2.second][b2.first], a[b1.second][b1.first])
-                        ? b2 : b1;
+                auto b1 = best(p1, p2);
+                auto b2 = best(p3, p4);
+                st[p] = best(b1, b2);
             }
         }
     }
 
-    std::pair<int, int> query(int p, int L, int T, int R, int B,
-                              int x1, int y1, int x2, int y2) const
+    Node query(int p, int L, int T, int R, int B,
+               int x1, int y1, int x2, int y2) const
     {
         if (L >= x1 && R <= x2 && T >= y1 && B <= y2) return st[p];
         if (L == R || x2 < (L + R) / 2 + 1) {
@@ -107,8 +270,7 @@ private:
                 auto p2 = query(bottomleft(p),
                                 L, (T + B) / 2 + 1, (L + R) / 2, B,
                                 x1, y1, x2, y2);
-                return f(a[p2.second][p2.first], a[p1.second][p1.first])
-                       ? p2 : p1;
+                return best(p1, p2);
             }
         } else if (x1 > (L + R) / 2) {
             if (T == B || y2 < (T + B) / 2 + 1) {
@@ -126,8 +288,7 @@ private:
                 auto p2 = query(bottomright(p),
                                 (L + R) / 2 + 1, (T + B) / 2 + 1, R, B,
                                 x1, y1, x2, y2);
-                return f(a[p2.second][p2.first], a[p1.second][p1.first])
-                       ? p2 : p1;
+                return best(p1, p2);
             }
         } else {
             if (T == B || y2 < (T + B) / 2 + 1) {
@@ -137,8 +298,7 @@ private:
                 auto p2 = query(topright(p),
                                 (L + R) / 2 + 1, T, R, (T + B) / 2,
                                 x1, y1, x2, y2);
-                return f(a[p2.second][p2.first], a[p1.second][p1.first])
-                       ? p2 : p1;
+                return best(p1, p2);
             } else if (y1 > (T + B) / 2) {
                 auto p1 = query(bottomleft(p),
                                 L, (T + B) / 2 + 1, (L + R) / 2, B,
@@ -146,8 +306,7 @@ private:
                 auto p2 = query(bottomright(p),
                                 (L + R) / 2 + 1, (T + B) / 2 + 1, R, B,
                                 x1, y1, x2, y2);
-                return f(a[p2.second][p2.first], a[p1.second][p1.first])
-                       ? p2 : p1;
+                return best(p1, p2);
             } else {
                 auto p1 = query(topleft(p),
                                 L, T, (L + R) / 2, (T + B) / 2,
@@ -161,12 +320,9 @@ private:
                 auto p4 = query(bottomright(p),
                                 (L + R) / 2 + 1, (T + B) / 2 + 1, R, B,
                                 x1, y1, x2, y2);
-                auto b1 = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                          ? p2 : p1;
-                auto b2 = f(a[p4.second][p4.first], a[p3.second][p3.first])
-                          ? p4 : p3;
-                return f(a[b2.second][b2.first], a[b1.second][b1.first])
-                       ? b2 : b1;
+                auto b1 = best(p1, p2);
+                auto b2 = best(p3, p4);
+                return best(b1, b2);
             }
         }
     }
@@ -174,15 +330,16 @@ private:
     void update(int p, int L, int T, int R, int B, int x, int y)
     {
         if (L == R) {
-            if (T != B) {
+            if (T == B) {
+                st[p] = Node::make(a, std::make_pair(L, T));
+            } else {
                 if (y > (T + B) / 2) {
                     update(bottomleft(p), L, (T + B) / 2 + 1, L, B, x, y);
                 } else {
                     update(topleft(p), L, T, L, (T + B) / 2, x, y);
                 }
                 auto p1 = st[topleft(p)], p2 = st[bottomleft(p)];
-                st[p] = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                        ? p2 : p1;
+                st[p] = best(p1, p2);
             }
         } else {
             if (T == B) {
@@ -192,8 +349,7 @@ private:
                     update(topleft(p), L, T, (L + R) / 2, T, x, y);
                 }
                 auto p1 = st[topleft(p)], p2 = st[topright(p)];
-                st[p] = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                        ? p2 : p1;
+                st[p] = best(p1, p2);
             } else {
                 if (x > (L + R) / 2) {
                     if (y > (T + B) / 2) {
@@ -214,32 +370,31 @@ private:
                 }
                 auto p1 = st[topleft(p)], p2 = st[topright(p)],
                      p3 = st[bottomleft(p)], p4 = st[bottomright(p)];
-                auto b1 = f(a[p2.second][p2.first], a[p1.second][p1.first])
-                          ? p2 : p1;
-                auto b2 = f(a[p4.second][p4.first], a[p3.second][p3.first])
-                          ? p4 : p3;
-                st[p] = f(a[b2.second][b2.first], a[b1.second][b1.first])
-                        ? b2 : b1;
+                auto b1 = best(p1, p2);
+                auto b2 = best(p3, p4);
+                st[p] = best(b1, b2);
             }
         }
     }
 
     Container a;
-    std::vector<std::pair<int, int>> st;
+    std::vector<Node> st;
     Compare f;
 };
 
 template<typename E, typename Container, typename Merge>
-class SegmentQuadtree<E, Container, Merge, true>
+class SegmentQuadtree<E, Container, Merge, true, SegmentQuadtreeHeapLayout,
+                      false>
 {
 public:
     SegmentQuadtree(const Container& a,
-                    const Merge& merge = Merge())
+                    const Merge& merge = Merge(),
+                    int threads = 1)
         : nx(a[0].size()), ny(a.size()), f(merge)
     {
         int max_dim = std::max(nx, ny);
         st.resize(max_dim * max_dim * 16 / 3);
-        build(0, 0, 0, nx - 1, ny - 1, a);
+        build(0, 0, 0, nx - 1, ny - 1, a, threads);
     }
 
     E query(int x1, int y1, int x2, int y2) const
@@ -258,27 +413,57 @@ private:
     static int bottomleft(int p) { return (p << 2) + 3; }
     static int bottomright(int p) { return (p << 2) + 4; }
 
-    void build(int p, int L, int T, int R, int B, const Container& a)
+    void build(int p, int L, int T, int R, int B, const Container& a,
+               int threads)
     {
+        long long cells = static_cast<long long>(R - L + 1) * (B - T + 1);
         if (L == R) {
             if (T == B) {
                 st[p] = a[T][L];
             } else {
-                build(topleft(p), L, T, L, (T + B) / 2, a);
-                build(bottomleft(p), L, (T + B) / 2 + 1, L, B, a);
+                segment_quadtree_detail::fork_join<E>(threads, cells,
+                    [this, p, L, T, B, &a](int t) {
+                        build(topleft(p), L, T, L, (T + B) / 2, a, t);
+                    },
+                    [this, p, L, T, B, &a](int t) {
+                        build(bottomleft(p), L, (T + B) / 2 + 1, L, B, a, t);
+                    });
                 st[p] = f(st[topleft(p)], st[bottomleft(p)]);
             }
         } else {
             if (T == B) {
-                build(topleft(p), L, T, (L + R) / 2, T, a);
-                build(topright(p), (L + R) / 2 + 1, T, R, T, a);
+                segment_quadtree_detail::fork_join<E>(threads, cells,
+                    [this, p, L, T, R, &a](int t) {
+                        build(topleft(p), L, T, (L + R) / 2, T, a, t);
+                    },
+                    [this, p, L, T, R, &a](int t) {
+                        build(topright(p), (L + R) / 2 + 1, T, R, T, a, t);
+                    });
                 st[p] = f(st[topleft(p)], st[topright(p)]);
             } else {
-                build(topleft(p), L, T, (L + R) / 2, (T + B) / 2, a);
-                build(topright(p), (L + R) / 2 + 1, T, R, (T + B) / 2, a);
-                build(bottomleft(p), L, (T + B) / 2 + 1, (L + R) / 2, B, a);
-                build(bottomright(p),
-                      (L + R) / 2 + 1, (T + B) / 2 + 1, R, B, a);
+                segment_quadtree_detail::fork_join<E>(threads, cells,
+                    [this, p, L, T, R, B, cells, &a](int t) {
+                        segment_quadtree_detail::fork_join<E>(t, cells / 2,
+                            [this, p, L, T, R, B, &a](int t) {
+                                build(topleft(p),
+                                      L, T, (L + R) / 2, (T + B) / 2, a, t);
+                            },
+                            [this, p, L, T, R, B, &a](int t) {
+                                build(topright(p), (L + R) / 2 + 1,
+                                      T, R, (T + B) / 2, a, t);
+                            });
+                    },
+                    [this, p, L, T, R, B, cells, &a](int t) {
+                        segment_quadtree_detail::fork_join<E>(t, cells / 2,
+                            [this, p, L, T, R, B, &a](int t) {
+                                build(bottomleft(p), L, (T + B) / 2 + 1,
+                                      (L + R) / 2, B, a, t);
+                            },
+                            [this, p, L, T, R, B, &a](int t) {
+                                build(bottomright(p), (L + R) / 2 + 1,
+                                      (T + B) / 2 + 1, R, B, a, t);
+                            });
+                    });
                 st[p] = f(f(f(st[topleft(p)], st[topright(p)]),
                             st[bottomleft(p)]), st[bottomright(p)]);
             }
@@ -404,3 +589,270 @@ private:
     std::vector<E> st;
     Merge f;
 };
+
+template<typename E, typename Container, typename Compare, bool cache>
+class SegmentQuadtree<E, Container, Compare, false,
+                      SegmentQuadtreeMortonLayout, cache>
+{
+    static_assert(!cache || std::is_trivially_copyable<E>::value,
+                  "cached values require a trivially copyable E");
+
+    typedef segment_quadtree_detail::comparator_node<E, int, cache> Node;
+
+public:
+    SegmentQuadtree(const Container& a,
+                    const Compare& compare = Compare(),
+                    int threads = 1)
+        : nx(a[0].size()), ny(a.size()), size(1), f(compare)
+    {
+        if (nx > 1 << 15 || ny > 1 << 15)
+            throw std::length_error("Morton layout supports at most "
+                                    "32768 x 32768 cells");
+        while (size < nx || size < ny) size <<= 1;
+        leaves = (size * size - 1) / 3;
+        v.resize(size * size);
+        st.resize(leaves + size * size);
+        for (int y = 0; y < ny; ++y) {
+            for (int x = 0; x < nx; ++x) {
+                v[segment_quadtree_detail::morton(x, y)] = a[y][x];
+            }
+        }
+        build(0, 0, 0, size, threads);
+    }
+
+    std::pair<int, int> query(int x1, int y1, int x2, int y2) const
+    {
+        int m = query(0, 0, 0, size, x1, y1, x2, y2).cell;
+        return {segment_quadtree_detail::deinterleave(m),
+                segment_quadtree_detail::deinterleave(m >> 1)};
+    }
+
+    void update(int x, int y, const E& val)
+    {
+        v[segment_quadtree_detail::morton(x, y)] = val;
+        update(x, y);
+    }
+
+    void update(int x, int y, E&& val)
+    {
+        v[segment_quadtree_detail::morton(x, y)] = std::move(val);
+        update(x, y);
+    }
+
+private:
+    static int child(int p, int k) { return (p << 2) + 1 + k; }
+
+    static Node none()
+    {
+        Node n = Node();
+        n.cell = -1;
+        return n;
+    }
+
+    Node best(const Node& n1, const Node& n2) const
+    {
+        if (n1.cell < 0) return n2;
+        if (n2.cell < 0) return n1;
+        return f(n2.value(v), n1.value(v)) ? n2 : n1;
+    }
+
+    void pull(int p)
+    {
+        st[p] = best(best(st[child(p, 0)], st[child(p, 1)]),
+                     best(st[child(p, 2)], st[child(p, 3)]));
+    }
+
+    void build(int p, int L, int T, int s, int threads)
+    {
+        if (L >= nx || T >= ny) {
+            st[p] = none();
+        } else if (s == 1) {
+            st[p] = Node::make(v, p - leaves);
+        } else {
+            int h = s / 2;
+            segment_quadtree_detail::fork_join<Node>(threads, 4LL * h * h,
+                [this, p, L, T, h](int t) {
+                    segment_quadtree_detail::fork_join<Node>(t, 2LL * h * h,
+                        [this, p, L, T, h](int t) {
+                            build(child(p, 0), L, T, h, t);
+                        },
+                        [this, p, L, T, h](int t) {
+                            build(child(p, 1), L + h, T, h, t);
+                        });
+                },
+                [this, p, L, T, h](int t) {
+                    segment_quadtree_detail::fork_join<Node>(t, 2LL * h * h,
+                        [this, p, L, T, h](int t) {
+                            build(child(p, 2), L, T + h, h, t);
+                        },
+                        [this, p, L, T, h](int t) {
+                            build(child(p, 3), L + h, T + h, h, t);
+                        });
+                });
+            pull(p);
+        }
+    }
+
+    Node query(int p, int L, int T, int s,
+               int x1, int y1, int x2, int y2) const
+    {
+        if (L >= x1 && L + s - 1 <= x2 && T >= y1 && T + s - 1 <= y2) {
+            return st[p];
+        }
+        if (s <= 4) {
+            const Node* c =
+                &st[leaves + segment_quadtree_detail::morton(L, T)];
+            Node ret = none();
+            for (int i = 0; i < s * s; ++i) {
+                int x = L + segment_quadtree_detail::deinterleave(i);
+                int y = T + segment_quadtree_detail::deinterleave(i >> 1);
+                if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {
+                    ret = best(ret, c[i]);
+                }
+            }
+            return ret;
+        }
+        int h = s / 2;
+        Node ret = none();
+        bool left = x1 < L + h, right = x2 >= L + h;
+        bool top = y1 < T + h, bottom = y2 >= T + h;
+        for (int k = 0; k < 4; ++k) {
+            if (!(k & 1 ? right : left) || !(k & 2 ? bottom : top)) continue;
+            ret = best(ret, query(child(p, k), L + (k & 1) * h,
+                                  T + (k >> 1) * h, h, x1, y1, x2, y2));
+        }
+        return ret;
+    }
+
+    void update(int x, int y)
+    {
+        int m = segment_quadtree_detail::morton(x, y), p = leaves + m;
+        st[p] = Node::make(v, m);
+        while (p > 0) {
+            p = (p - 1) >> 2;
+            pull(p);
+        }
+    }
+
+    int nx, ny, size, leaves;
+    std::vector<E> v;
+    std::vector<Node> st;
+    Compare f;
+};
+
+template<typename E, typename Container, typename Merge>
+class SegmentQuadtree<E, Container, Merge, true,
+                      SegmentQuadtreeMortonLayout, false>
+{
+public:
+    SegmentQuadtree(const Container& a,
+                    const Merge& merge = Merge(),
+                    int threads = 1)
+        : nx(a[0].size()), ny(a.size()), size(1), f(merge)
+    {
+        if (nx > 1 << 15 || ny > 1 << 15)
+            throw std::length_error("Morton layout supports at most "
+                                    "32768 x 32768 cells");
+        while (size < nx || size < ny) size <<= 1;
+        leaves = (size * size - 1) / 3;
+        st.resize(leaves + size * size);
+        build(0, 0, 0, size, a, threads);
+    }
+
+    E query(int x1, int y1, int x2, int y2) const
+    {
+        return query(0, 0, 0, size, x1, y1, x2, y2);
+    }
+
+    void update(int x, int y, const E& v)
+    {
+        int p = leaves + segment_quadtree_detail::morton(x, y);
+        st[p] = v;
+        for (int s = 2; p > 0; s <<= 1) {
+            p = (p - 1) >> 2;
+            pull(p, x & -s, y & -s, s);
+        }
+    }
+
+private:
+    static int child(int p, int k) { return (p << 2) + 1 + k; }
+
+    void pull(int p, int L, int T, int s)
+    {
+        st[p] = st[child(p, 0)];
+        if (L + s / 2 < nx) st[p] = f(st[p], st[child(p, 1)]);
+        if (T + s / 2 < ny) {
+            st[p] = f(st[p], st[child(p, 2)]);
+            if (L + s / 2 < nx) st[p] = f(st[p], st[child(p, 3)]);
+        }
+    }
+
+    void build(int p, int L, int T, int s, const Container& a, int threads)
+    {
+        if (L >= nx || T >= ny) return;
+        if (s == 1) {
+            st[p] = a[T][L];
+        } else {
+            int h = s / 2;
+            segment_quadtree_detail::fork_join<E>(threads, 4LL * h * h,
+                [this, p, L, T, h, &a](int t) {
+                    segment_quadtree_detail::fork_join<E>(t, 2LL * h * h,
+                        [this, p, L, T, h, &a](int t) {
+                            build(child(p, 0), L, T, h, a, t);
+                        },
+                        [this, p, L, T, h, &a](int t) {
+                            build(child(p, 1), L + h, T, h, a, t);
+                        });
+                },
+                [this, p, L, T, h, &a](int t) {
+                    segment_quadtree_detail::fork_join<E>(t, 2LL * h * h,
+                        [this, p, L, T, h, &a](int t) {
+                            build(child(p, 2), L, T + h, h, a, t);
+                        },
+                        [this, p, L, T, h, &a](int t) {
+                            build(child(p, 3), L + h, T + h, h, a, t);
+                        });
+                });
+            pull(p, L, T, s);
+        }
+    }
+
+    E query(int p, int L, int T, int s,
+            int x1, int y1, int x2, int y2) const
+    {
+        if (L >= x1 && L + s - 1 <= x2 && T >= y1 && T + s - 1 <= y2) {
+            return st[p];
+        }
+        if (s <= 4) {
+            int c = leaves + segment_quadtree_detail::morton(L, T);
+            bool found = false;
+            E ret = E();
+            for (int i = 0; i < s * s; ++i) {
+                int x = L + segment_quadtree_detail::deinterleave(i);
+                int y = T + segment_quadtree_detail::deinterleave(i >> 1);
+                if (x >= x1 && x <= x2 && y >= y1 && y <= y2) {
+                    ret = found ? f(ret, st[c + i]) : st[c + i];
+                    found = true;
+                }
+            }
+            return ret;
+        }
+        int h = s / 2;
+        bool left = x1 < L + h, right = x2 >= L + h;
+        bool top = y1 < T + h, bottom = y2 >= T + h;
+        bool found = false;
+        E ret = E();
+        for (int k = 0; k < 4; ++k) {
+            if (!(k & 1 ? right : left) || !(k & 2 ? bottom : top)) continue;
+            E v = query(child(p, k), L + (k & 1) * h, T + (k >> 1) * h, h,
+                        x1, y1, x2, y2);
+            ret = found ? f(ret, v) : v;
+            found = true;
+        }
+        return ret;
+    }
+
+    int nx, ny, size, leaves;
+    std::vector<E> st;
+    Merge f;
+};
@@ -1,63 +1,228 @@
 #include <vector>
 #include <algorithm>
-#include <limits>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
 
-template <typename T, typename Interval>
+/* Segment tree over the m distinct interval endpoints, with 2m + 1 leaves:
+ * one per endpoint and one per open gap around them, so keys only need the
+ * strict weak order given by Compare (floating point, wide or custom keys
+ * work without +1 or numeric limits). Intervals are closed, and each is
+ * stored in the O(log m) nodes that cover its leaves. Intervals are kept
+ * once in a contiguous array and nodes store 32-bit handles into it, packed
+ * into one CSR buffer at build time with later insertions chained from each
+ * node through a shared overflow list. insert returns a handle for erase.
+ * Intervals whose start and end are already endpoints (of other intervals
+ * or points declared up front) go straight into the tree; others wait in a
+ * pending list that queries scan until it grows past 4 sqrt(size) and the
+ * leaves are rebuilt. Erased intervals are tombstoned and removed by a
+ * rebuild once they make up half of the tree. */
+template <typename T, typename Interval, typename Compare = std::less<T>>
 class SegmentStabbingTree
 {
     struct Entry
     {
         bool leaf;
-        T start;
-        T end;
-        std::vector<Interval> subset;
+        int start;
+        int end;
+        int live;
+        int stored;
+        int starts;
+        std::uint32_t head;
     };
 
+    struct Link
+    {
+        std::uint32_t item;
+        std::uint32_t next;
+    };
+
+    enum State { FREE, TREE, PENDING };
+
 public:
     template<typename InputIt>
-    SegmentStabbingTree(InputIt first, InputIt last)
-    {
-        std::vector<T> endpoints;
-        for (auto it = first; it != last; ++it) {
-            endpoints.push_back(it->start);
-            endpoints.push_back(it->end);
-        }
-        std::sort(endpoints.begin(), endpoints.end());
-        endpoints.erase(std::unique(endpoints.begin(), endpoints.end()),
-                        endpoints.end());
-        std::vector<std::pair<T, T>> leaves;
-        leaves.reserve(2 * endpoints.size() + 1);
-        if (endpoints.empty()) {
-            leaves.emplace_back(std::numeric_limits<T>::lowest(),
-                                std::numeric_limits<T>::max());
+    SegmentStabbingTree(InputIt first, InputIt last,
+                        const Compare& compare = Compare())
+        : comp(compare)
+    {
+        for (; first != last; ++first) add(*first);
+        rebuild();
+    }
+
+    /* Also makes every point in [pfirst, plast) an endpoint, so that
+     * later intervals starting or ending there are inserted in O(log n). */
+    template<typename InputIt, typename PointIt>
+    SegmentStabbingTree(InputIt first, InputIt last,
+                        PointIt pfirst, PointIt plast,
+                        const Compare& compare = Compare())
+        : declared(pfirst, plast), comp(compare)
+    {
+        sortUnique(declared);
+        for (; first != last; ++first) add(*first);
+        rebuild();
+    }
+
+    int insert(const Interval& interval)
+    {
+        int h = add(interval);
+        int l = leaf(interval.start), r = leaf(interval.end);
+        if (l & r & 1) {
+            state[h] = TREE;
+            span[h] = std::make_pair(l, r);
+            cover(0, l, r, [this, h](int p) {
+                extra.push_back(Link{static_cast<std::uint32_t>(h),
+                                     st[p].head});
+                st[p].head = extra.size() - 1;
+                ++st[p].live;
+                ++st[p].stored;
+                ++slots;
+            });
+            addStart(l, 1);
         } else {
-            if (endpoints[0] > std::numeric_limits<T>::lowest()) {
-                leaves.emplace_back(std::numeric_limits<T>::lowest(),
-                                    endpoints[0] - 1);
-            }
-            for (int i = 0; i < static_cast<int>(endpoints.size()) - 1; ++i) {
-                leaves.emplace_back(endpoints[i], endpoints[i]);
-                if (endpoints[i + 1] > endpoints[i] + 1) {
-                    leaves.emplace_back(endpoints[i] + 1, endpoints[i + 1] - 1);
-                }
+            state[h] = PENDING;
+            pending.push_back(h);
+            int m = pending.size();
+            if (m > 64 && m * m > live * 16) rebuild();
+        }
+        return h;
+    }
+
+    void erase(int handle)
+    {
+        if (state[handle] == PENDING) {
+            std::swap(*std::find(pending.begin(), pending.end(), handle),
+                      pending.back());
+            pending.pop_back();
+            unused.push_back(handle);
+        } else {
+            cover(0, span[handle].first, span[handle].second,
+                  [this](int p) { --st[p].live; ++stale; });
+            addStart(span[handle].first, -1);
+        }
+        state[handle] = FREE;
+        --live;
+        if (stale * 2 > slots) rebuild();
+    }
+
+    int size() const { return live; }
+
+    const Interval& operator[](int handle) const { return items[handle]; }
+
+    std::vector<Interval> query(const T& i) const
+    {
+        std::vector<Interval> ret;
+        ret.reserve(count(i));
+        query(i, std::back_inserter(ret));
+        return ret;
+    }
+
+    /* Writes the intervals containing i to out without allocating. */
+    template<typename OutputIt>
+    OutputIt query(const T& i, OutputIt out) const
+    {
+        visit(i, [&out](const Interval& interval) { *out++ = interval; });
+        return out;
+    }
+
+    /* Writes the handles of the intervals containing i to out, for use
+     * with operator[] instead of copying the intervals. */
+    template<typename OutputIt>
+    OutputIt queryHandles(const T& i, OutputIt out) const
+    {
+        visitHandles(i, [&out](int h) { *out++ = h; });
+        return out;
+    }
+
+    /* Calls f(interval) for every interval containing i. */
+    template<typename Function>
+    void visit(const T& i, Function f) const
+    {
+        visitHandles(i, [this, &f](int h) { f(items[h]); });
+    }
+
+    /* Calls sink(i, interval) for every point i in [first, last) and every
+     * interval containing it. The points are sorted and answered in one
+     * sweep over the tree, each node being visited once for the run of
+     * points below it, so pairs come grouped by node rather than by point. */
+    template<typename InputIt, typename Sink>
+    void queryBatch(InputIt first, InputIt last, Sink sink) const
+    {
+        std::vector<T> points(first, last);
+        std::sort(points.begin(), points.end(), comp);
+        if (points.empty()) return;
+        std::vector<int> leaves(points.size());
+        for (int k = 0, e = 0; k < static_cast<int>(points.size()); ++k) {
+            while (e < static_cast<int>(endpoints.size()) &&
+                   comp(endpoints[e], points[k])) {
+                ++e;
             }
-            leaves.emplace_back(endpoints[endpoints.size() - 1],
-                                endpoints[endpoints.size() - 1]);
-            if (endpoints[endpoints.size() - 1] <
-                    std::numeric_limits<T>::max()) {
-                leaves.emplace_back(endpoints[endpoints.size() - 1] + 1,
-                                    std::numeric_limits<T>::max());
+            bool at = e < static_cast<int>(endpoints.size()) &&
+                      !comp(points[k], endpoints[e]);
+            leaves[k] = 2 * e + at;
+        }
+        queryBatch(0, 0, points.size(), points, leaves, sink);
+        for (int h : pending) {
+            const Interval& interval = items[h];
+            auto it = std::lower_bound(points.begin(), points.end(),
+                                       interval.start, comp);
+            for (; it != points.end() && !comp(interval.end, *it); ++it) {
+                sink(*it, interval);
             }
         }
-        st.resize(leaves.size() * 4);
-        build(0, 0, leaves.size() - 1, leaves);
-        for (auto it = first; it != last; ++it) insert(0, *it);
     }
 
-    std::vector<Interval> query(int i) const
+    /* Calls f(interval) once for every interval overlapping [a, b]. Each is
+     * reported at the first of its nodes that meets [a, b]: the ones on the
+     * path to a report everything, the others only intervals starting where
+     * they start, and subtrees without such starts are skipped, giving
+     * O((k + 1) log n) for k intervals plus a scan of the pending ones. */
+    template<typename Function>
+    void visit(const T& a, const T& b, Function f) const
     {
-        std::vector<Interval> ret;
-        query(0, i, ret);
+        auto g = [this, &f](int h) { f(items[h]); };
+        overlaps(0, leaf(a), leaf(b), g);
+        for (int h : pending) {
+            if (overlaps(items[h], a, b)) f(items[h]);
+        }
+    }
+
+    /* Writes the intervals overlapping [a, b] to out. */
+    template<typename OutputIt>
+    OutputIt query(const T& a, const T& b, OutputIt out) const
+    {
+        visit(a, b, [&out](const Interval& interval) { *out++ = interval; });
+        return out;
+    }
+
+    /* Number of intervals overlapping [a, b] in O(log n) plus a scan of
+     * the pending intervals: those containing a and those starting in
+     * (a, b]. */
+    int count(const T& a, const T& b) const
+    {
+        int x = leaf(a), ret = startsUpTo(leaf(b)) - startsUpTo(x);
+        for (int p = 0; ; p = child(p, x)) {
+            ret += st[p].live;
+            if (st[p].leaf) break;
+        }
+        for (int h : pending) {
+            if (overlaps(items[h], a, b)) ++ret;
+        }
+        return ret;
+    }
+
+    /* Number of intervals containing i in O(log n) plus a scan of the
+     * pending intervals. */
+    int count(const T& i) const
+    {
+        int x = leaf(i), ret = 0;
+        for (int p = 0; ; p = child(p, x)) {
+            ret += st[p].live;
+            if (st[p].leaf) break;
+        }
+        for (int h : pending) {
+            if (overlaps(items[h], i, i)) ++ret;
+        }
         return ret;
     }
 
@@ -65,38 +230,237 @@ private:
     static int left(int p) { return (p << 1) + 1; }
     static int right(int p) { return (p << 1) + 2; }
 
-    void build(int p, int L, int R, std::vector<std::pair<T, T>>& leaves)
+    int child(int p, int x) const
     {
-        if (L == R) {
-            st[p].leaf = true;
-            st[p].start = leaves[L].first;
-            st[p].end = leaves[L].second;
-        } else {
-            build(left(p), L, (L + R) / 2, leaves);
-            build(right(p), (L + R) / 2 + 1, R, leaves);
-            st[p].start = st[left(p)].start;
-            st[p].end = st[right(p)].end;
+        return x <= st[left(p)].end ? left(p) : right(p);
+    }
+
+    /* Index of the leaf containing i: 2k + 1 for the k-th endpoint and 2k
+     * for the gap before it. */
+    int leaf(const T& i) const
+    {
+        int k = std::lower_bound(endpoints.begin(), endpoints.end(), i, comp) -
+                endpoints.begin();
+        return k < static_cast<int>(endpoints.size()) &&
+               !comp(i, endpoints[k]) ? 2 * k + 1 : 2 * k;
+    }
+
+    bool overlaps(const Interval& interval, const T& a, const T& b) const
+    {
+        return !comp(b, interval.start) && !comp(interval.end, a);
+    }
+
+    void sortUnique(std::vector<T>& v) const
+    {
+        std::sort(v.begin(), v.end(), comp);
+        v.erase(std::unique(v.begin(), v.end(),
+                            [this](const T& x, const T& y) {
+                                return !comp(x, y) && !comp(y, x);
+                            }), v.end());
+    }
+
+    /* Calls f(h) for the handle of every live interval stored at p. */
+    template<typename Function>
+    void subset(int p, Function& f) const
+    {
+        if (!st[p].live) return;
+        bool clean = st[p].live == st[p].stored;
+        for (std::uint32_t k = offset[p]; k < offset[p + 1]; ++k) {
+            if (clean || state[subsets[k]] == TREE) f(subsets[k]);
+        }
+        for (std::uint32_t k = st[p].head; k; k = extra[k].next) {
+            if (clean || state[extra[k].item] == TREE) f(extra[k].item);
         }
     }
 
-    void insert(int p, const Interval& interval)
+    /* Reports the intervals at p, which meets leaves [a, b], whose first
+     * node meeting [a, b] is p, then recurses. Past a, subsets are packed by
+     * descending start so those starting at p come first. */
+    template<typename Function>
+    void overlaps(int p, int a, int b, Function& f) const
     {
-        if (st[p].start >= interval.start && st[p].end <= interval.end) {
-            st[p].subset.push_back(interval);
-        } else {
-            if (interval.start <= st[left(p)].end) insert(left(p), interval);
-            if (interval.end >= st[right(p)].start) insert(right(p), interval);
+        if (st[p].start <= a) {
+            subset(p, f);
+        } else if (!st[p].starts) {
+            return;
+        } else if (st[p].live) {
+            int start = st[p].start;
+            for (std::uint32_t k = offset[p]; k < offset[p + 1]; ++k) {
+                int h = subsets[k];
+                if (span[h].first < start) break;
+                if (state[h] == TREE) f(h);
+            }
+            for (std::uint32_t k = st[p].head; k; k = extra[k].next) {
+                int h = extra[k].item;
+                if (state[h] == TREE && span[h].first == start) f(h);
+            }
+        }
+        if (st[p].leaf) return;
+        if (st[left(p)].end >= a) overlaps(left(p), a, b, f);
+        if (st[right(p)].start <= b) overlaps(right(p), a, b, f);
+    }
+
+    /* Number of intervals in the tree starting at or before leaf x. */
+    int startsUpTo(int x) const
+    {
+        int ret = 0, p = 0;
+        while (!st[p].leaf) {
+            if (x <= st[left(p)].end) {
+                p = left(p);
+            } else {
+                ret += st[left(p)].starts;
+                p = right(p);
+            }
+        }
+        return ret + st[p].starts;
+    }
+
+    void addStart(int start, int d)
+    {
+        for (int p = 0; ; p = child(p, start)) {
+            st[p].starts += d;
+            if (st[p].leaf) break;
+        }
+    }
+
+    template<typename Function>
+    void visitHandles(const T& i, Function f) const
+    {
+        int x = leaf(i);
+        for (int p = 0; ; p = child(p, x)) {
+            subset(p, f);
+            if (st[p].leaf) break;
+        }
+        for (int h : pending) {
+            if (overlaps(items[h], i, i)) f(h);
+        }
+    }
+
+    /* Answers the sorted points [first, last), all of which lie in p. */
+    template<typename Sink>
+    void queryBatch(int p, int first, int last, const std::vector<T>& points,
+                    const std::vector<int>& leaves, Sink& sink) const
+    {
+        auto emit = [this, first, last, &points, &sink](int h) {
+            for (int k = first; k < last; ++k) sink(points[k], items[h]);
+        };
+        subset(p, emit);
+        if (st[p].leaf) return;
+        int mid = std::upper_bound(leaves.begin() + first,
+                                   leaves.begin() + last,
+                                   st[left(p)].end) - leaves.begin();
+        if (first != mid) {
+            queryBatch(left(p), first, mid, points, leaves, sink);
+        }
+        if (mid != last) {
+            queryBatch(right(p), mid, last, points, leaves, sink);
         }
     }
 
-    void query(int p, int i, std::vector<Interval>& result) const
+    int add(const Interval& interval)
     {
-        result.insert(result.end(), st[p].subset.begin(), st[p].subset.end());
-        if (!st[p].leaf) {
-            if (i <= st[left(p)].end) query(left(p), i, result);
-            else query(right(p), i, result);
+        ++live;
+        if (unused.empty()) {
+            items.push_back(interval);
+            state.push_back(TREE);
+            span.emplace_back();
+            return items.size() - 1;
+        }
+        int h = unused.back();
+        unused.pop_back();
+        items[h] = interval;
+        state[h] = TREE;
+        return h;
+    }
+
+    /* Recomputes the leaves from the declared points and the endpoints of
+     * the live intervals, and reinserts those, dropping tombstones. Handles
+     * are kept; erased ones become reusable as no node refers to them. */
+    void rebuild()
+    {
+        endpoints = declared;
+        for (int h = 0; h < static_cast<int>(items.size()); ++h) {
+            if (state[h] != FREE) {
+                endpoints.push_back(items[h].start);
+                endpoints.push_back(items[h].end);
+            }
+        }
+        sortUnique(endpoints);
+        int leaves = endpoints.size() * 2 + 1;
+        st.assign(leaves * 4, Entry());
+        build(0, 0, leaves - 1);
+        pending.clear();
+        unused.clear();
+        extra.assign(1, Link{0, 0});
+        stale = 0;
+        offset.assign(st.size() + 1, 0);
+        std::vector<int> order;
+        for (int h = 0; h < static_cast<int>(items.size()); ++h) {
+            if (state[h] == FREE) {
+                unused.push_back(h);
+            } else {
+                state[h] = TREE;
+                order.push_back(h);
+                span[h] = std::make_pair(leaf(items[h].start),
+                                         leaf(items[h].end));
+                cover(0, span[h].first, span[h].second,
+                      [this](int p) { ++offset[p + 1]; });
+                addStart(span[h].first, 1);
+            }
+        }
+        for (int p = 0; p < static_cast<int>(st.size()); ++p) {
+            st[p].live = st[p].stored = offset[p + 1];
+            offset[p + 1] += offset[p];
+        }
+        slots = offset.back();
+        subsets.resize(slots);
+        std::vector<std::uint32_t> next(offset.begin(), offset.end() - 1);
+        std::stable_sort(order.begin(), order.end(), [this](int x, int y) {
+            return span[y].first < span[x].first;
+        });
+        for (int h : order) {
+            cover(0, span[h].first, span[h].second, [this, h, &next](int p) {
+                subsets[next[p]++] = h;
+            });
+        }
+    }
+
+    void build(int p, int L, int R)
+    {
+        st[p].leaf = L == R;
+        st[p].start = L;
+        st[p].end = R;
+        if (L != R) {
+            build(left(p), L, (L + R) / 2);
+            build(right(p), (L + R) / 2 + 1, R);
+        }
+    }
+
+    /* Calls f(p) for every node p of the canonical cover of leaves [l, r]. */
+    template<typename Function>
+    void cover(int p, int l, int r, Function f)
+    {
+        if (st[p].start >= l && st[p].end <= r) {
+            f(p);
+        } else {
+            if (l <= st[left(p)].end) cover(left(p), l, r, f);
+            if (r >= st[right(p)].start) cover(right(p), l, r, f);
         }
     }
 
     std::vector<Entry> st;
+    std::vector<std::uint32_t> offset;
+    std::vector<std::uint32_t> subsets;
+    std::vector<Link> extra;
+    std::vector<Interval> items;
+    std::vector<std::pair<int, int>> span;
+    std::vector<char> state;
+    std::vector<T> endpoints;
+    std::vector<T> declared;
+    std::vector<int> pending;
+    std::vector<int> unused;
+    int live = 0;
+    int stale = 0;
+    int slots = 0;
+    Compare comp;
 };
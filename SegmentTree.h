@@ -1,38 +1,276 @@
 #include <vector>
+#include <algorithm>
+#include <cstddef>
 #include <functional>
+#include <thread>
+#include <type_traits>
 #include <utility>
 
+namespace segment_tree_detail {
+
+/* Answers a batch of (i, j) ranges in sorted order so that consecutive
+ * queries share the cached top of the tree, then restores input order. */
+template<typename Tree, typename InputIt, typename OutputIt>
+OutputIt query_batch(const Tree& tree, InputIt first, InputIt last,
+                     OutputIt out)
+{
+    std::vector<std::pair<std::pair<int, int>, int>> q;
+    for (; first != last; ++first) {
+        q.emplace_back(std::make_pair(std::get<0>(*first),
+                                      std::get<1>(*first)), q.size());
+    }
+    std::sort(q.begin(), q.end());
+    std::vector<decltype(tree.query(0, 0))> ret(q.size());
+    for (const auto& e : q) {
+        ret[e.second] = tree.query(e.first.first, e.first.second);
+    }
+    return std::copy(ret.begin(), ret.end(), out);
+}
+
+/* Number of threads to use for elements nodes of type Node: at most one per
+ * 1 << 14 nodes, and only one for bool, as std::vector<bool> packs nodes
+ * into shared words. */
+template<typename Node>
+int workers(int threads, long long elements)
+{
+    if (std::is_same<Node, bool>::value) return 1;
+    return std::max(1LL, std::min<long long>(threads, elements >> 14));
+}
+
+/* Runs f1(threads1) and f2(threads2) over elements nodes, on two threads
+ * when workers() allows it, splitting the thread budget between them. */
+template<typename Node, typename F1, typename F2>
+void fork_join(int threads, long long elements, F1 f1, F2 f2)
+{
+    if (workers<Node>(threads, elements) > 1) {
+        std::thread t(f1, threads / 2);
+        f2(threads - threads / 2);
+        t.join();
+    } else {
+        f1(1);
+        f2(1);
+    }
+}
+
+/* Calls f(i) for every node i in [first, last) on up to workers() threads,
+ * each handling a contiguous chunk of indices. */
+template<typename Node, typename F>
+void parallel_for(int first, int last, int threads, F f)
+{
+    threads = workers<Node>(threads, last - first);
+    int chunk = (last - first + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        int b = first + t * chunk, e = std::min(last, b + chunk);
+        pool.emplace_back([b, e, &f] { for (int i = b; i < e; ++i) f(i); });
+    }
+    for (int i = first; i < std::min(last, first + chunk); ++i) f(i);
+    for (auto& t : pool) t.join();
+}
+
+/* Stores the nodes of a bottom-up tree of n leaves that cover [i, j] in
+ * left-to-right order and returns their count (at most 64). */
+inline int decompose(int n, int i, int j, int* nodes)
+{
+    int k = 0, m = 64;
+    for (int l = i + n, r = j + n + 1; l < r; l >>= 1, r >>= 1) {
+        if (l & 1) nodes[k++] = l++;
+        if (r & 1) nodes[--m] = --r;
+    }
+    return std::copy(nodes + m, nodes + 64, nodes + k) - nodes;
+}
+
+/* Node of a comparator tree: the index of the best element and, when cached,
+ * a copy of its value so comparisons do not go back to the container. */
+template<typename T, bool cache>
+struct comparator_node
+{
+    static comparator_node none()
+    {
+        comparator_node n = comparator_node();
+        n.index = -1;
+        return n;
+    }
+
+    template<typename Container>
+    static comparator_node make(const Container& a, int i)
+    {
+        comparator_node n;
+        n.index = i;
+        n.cached = a[i];
+        return n;
+    }
+
+    template<typename Container>
+    const T& value(const Container&) const { return cached; }
+
+    int index;
+    T cached;
+};
+
+template<typename T>
+struct comparator_node<T, false>
+{
+    static comparator_node none()
+    {
+        comparator_node n;
+        n.index = -1;
+        return n;
+    }
+
+    template<typename Container>
+    static comparator_node make(const Container&, int i)
+    {
+        comparator_node n;
+        n.index = i;
+        return n;
+    }
+
+    template<typename Container>
+    auto value(const Container& a) const -> decltype(a[0])
+    {
+        return a[index];
+    }
+
+    int index;
+};
+
+} // namespace segment_tree_detail
+
+/* Recursive top-down tree with nodes in BFS heap order (at most 4n nodes) */
+struct SegmentTreeHeapLayout
+{
+    static int left(int p) { return (p << 1) + 1; }
+    static int right(int p) { return (p << 1) + 2; }
+
+    static int size(int n)
+    {
+        int nodes = 1;
+        while (nodes < n) nodes <<= 1;
+        return nodes << 1;
+    }
+};
+
+/* Iterative bottom-up tree with leaves stored at [n, 2n) (2n nodes) */
+struct SegmentTreeBottomUpLayout {};
+
+/* Immutable sparse table answering comparator queries in O(1)
+ * (n log n nodes, no update) */
+struct SegmentTreeSparseTableLayout {};
+
+/* Iterative bottom-up tree with 8 (or 16 for types up to 4 bytes) children
+ * per node, so that the children of a node fill one cache line and are
+ * combined with SIMD-friendly fixed-width loops. Requires a commutative and
+ * associative merge with an identity given by SegmentTreeWideTraits. */
+struct SegmentTreeWideLayout {};
+
+/* Merges usable with SegmentTreeWideLayout; chosen automatically for these
+ * unless T is floating point, where its different summation order would
+ * change rounding. Specialize with value = true and identity() to enable
+ * other merges. bool is left out since the wide layout needs a T* into
+ * std::vector<T>. */
+template<typename Merge, typename T, typename = void>
+struct SegmentTreeWideTraits
+{
+    static const bool value = false;
+};
+
+template<typename T>
+struct SegmentTreeWideTraits<std::plus<T>, T, typename std::enable_if<
+    std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static const bool value = true;
+    static T identity() { return T(); }
+};
+
+template<typename T>
+struct SegmentTreeWideTraits<std::bit_or<T>, T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static const bool value = true;
+    static T identity() { return T(); }
+};
+
+template<typename T>
+struct SegmentTreeWideTraits<std::bit_xor<T>, T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static const bool value = true;
+    static T identity() { return T(); }
+};
+
+template<typename T>
+struct SegmentTreeWideTraits<std::bit_and<T>, T, typename std::enable_if<
+    std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static const bool value = true;
+    static T identity() { return ~T(); }
+};
+
+/* findFirst(i, pred) returns the smallest j >= i and findLast(j, pred) the
+ * largest i <= j for which pred holds, or -1 if there is none, in a single
+ * O(log n) walk. With a merge, pred is tested on query(i, j) and must turn
+ * from false to true as the range grows; lowerBoundPrefix(x) is the first j
+ * with query(0, j) >= x (the k-th one in a tree of 0/1 counts). With a
+ * comparator, pred is tested on single elements and must hold for the best
+ * element of every range containing an element satisfying it, e.g. v < t
+ * with std::less. With cache set, comparator trees keep a copy of the best
+ * value in every node next to its index, so queries compare node-local data
+ * instead of loading from the container (T must be trivially copyable). */
 template<typename T, typename Container = std::vector<T>,
-         typename Function = std::less<T>, bool merge = false>
+         typename Function = std::less<T>, bool merge = false,
+         typename Layout = typename std::conditional<
+             merge && SegmentTreeWideTraits<Function, T>::value &&
+             !std::is_floating_point<T>::value,
+             SegmentTreeWideLayout, SegmentTreeHeapLayout>::type,
+         bool cache = false>
 class SegmentTree;
 
-template<typename T, typename Container, typename Compare>
-class SegmentTree<T, Container, Compare, false>
+template<typename T, typename Container, typename Compare, typename Layout,
+         bool cache>
+class SegmentTree<T, Container, Compare, false, Layout, cache>
 {
+    static_assert(!cache || std::is_trivially_copyable<T>::value,
+                  "cached values require a trivially copyable T");
+
+    typedef segment_tree_detail::comparator_node<T, cache> Node;
+
 public:
     SegmentTree(const Container& c,
-                const Compare& compare = Compare())
-        : a(c), st(a.size() * 4), f(compare)
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(c), st(Layout::size(a.size())), f(compare)
     {
-        build(0, 0, a.size() - 1);
+        build(0, 0, a.size() - 1, threads);
     }
 
     SegmentTree(Container&& c,
-                const Compare& compare = Compare())
-        : a(std::move(c)), st(a.size() * 4), f(compare)
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(std::move(c)), st(Layout::size(a.size())), f(compare)
     {
-        build(0, 0, a.size() - 1);
+        build(0, 0, a.size() - 1, threads);
     }
 
     template<typename InputIt>
     SegmentTree(InputIt first, InputIt last,
-                const Compare& compare = Compare())
-        : a(first, last), st(a.size() * 4), f(compare)
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(first, last), st(Layout::size(a.size())), f(compare)
     {
-        build(0, 0, a.size() - 1);
+        build(0, 0, a.size() - 1, threads);
     }
 
-    int query(int i, int j) const { return query(0, 0, a.size() - 1, i, j); }
+    int query(int i, int j) const
+    {
+        return query(0, 0, a.size() - 1, i, j).index;
+    }
+
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
 
     void update(int i, const T& v)
     {
@@ -46,23 +284,42 @@ public:
         update(0, 0, a.size() - 1, i);
     }
 
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        return findFirst(0, 0, a.size() - 1, i, pred);
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        return findLast(0, 0, a.size() - 1, j, pred);
+    }
+
 private:
-    static int left(int p) { return (p << 1) + 1; }
-    static int right(int p) { return (p << 1) + 2; }
+    static int left(int p) { return Layout::left(p); }
+    static int right(int p) { return Layout::right(p); }
+
+    Node best(const Node& n1, const Node& n2) const
+    {
+        return f(n2.value(a), n1.value(a)) ? n2 : n1;
+    }
 
-    void build(int p, int L, int R)
+    void build(int p, int L, int R, int threads)
     {
         if (L == R) {
-            st[p] = L;
+            st[p] = Node::make(a, L);
         } else {
-            build(left(p), L, (L + R) / 2);
-            build(right(p), (L + R) / 2 + 1, R);
-            int p1 = st[left(p)], p2 = st[right(p)];
-            st[p] = f(a[p2], a[p1]) ? p2 : p1;
+            segment_tree_detail::fork_join<Node>(threads, R - L + 1,
+                [this, p, L, R](int t) { build(left(p), L, (L + R) / 2, t); },
+                [this, p, L, R](int t) {
+                    build(right(p), (L + R) / 2 + 1, R, t);
+                });
+            st[p] = best(st[left(p)], st[right(p)]);
         }
     }
 
-    int query(int p, int L, int R, int i, int j) const
+    Node query(int p, int L, int R, int i, int j) const
     {
         if (L >= i && R <= j) return st[p];
         if (j < (L + R) / 2 + 1) {
@@ -70,70 +327,124 @@ private:
         } else if (i > (L + R) / 2) {
             return query(right(p), (L + R) / 2 + 1, R, i, j);
         } else {
-            int p1 = query(left(p), L, (L + R) / 2, i, j);
-            int p2 = query(right(p), (L + R) / 2 + 1, R, i, j);
-            return f(a[p2], a[p1]) ? p2 : p1;
+            return best(query(left(p), L, (L + R) / 2, i, j),
+                        query(right(p), (L + R) / 2 + 1, R, i, j));
         }
     }
 
     void update(int p, int L, int R, int i)
     {
-        if (L != R) {
+        if (L == R) {
+            st[p] = Node::make(a, L);
+        } else {
             if (i > (L + R) / 2) {
                 update(right(p), (L + R) / 2 + 1, R, i);
             } else {
                 update(left(p), L, (L + R) / 2, i);
             }
-            int p1 = st[left(p)], p2 = st[right(p)];
-            st[p] = f(a[p2], a[p1]) ? p2 : p1;
+            st[p] = best(st[left(p)], st[right(p)]);
         }
     }
 
+    template<typename Predicate>
+    int findFirst(int p, int L, int R, int i, Predicate& pred) const
+    {
+        if (R < i || !pred(st[p].value(a))) return -1;
+        if (L == R) return L;
+        int ret = findFirst(left(p), L, (L + R) / 2, i, pred);
+        if (ret < 0) ret = findFirst(right(p), (L + R) / 2 + 1, R, i, pred);
+        return ret;
+    }
+
+    template<typename Predicate>
+    int findLast(int p, int L, int R, int j, Predicate& pred) const
+    {
+        if (L > j || !pred(st[p].value(a))) return -1;
+        if (L == R) return L;
+        int ret = findLast(right(p), (L + R) / 2 + 1, R, j, pred);
+        if (ret < 0) ret = findLast(left(p), L, (L + R) / 2, j, pred);
+        return ret;
+    }
+
     Container a;
-    std::vector<int> st;
+    std::vector<Node> st;
     Compare f;
 };
 
-template <typename T, typename Container, typename Merge>
-class SegmentTree<T, Container, Merge, true>
+template<typename T, typename Container, typename Merge, typename Layout>
+class SegmentTree<T, Container, Merge, true, Layout, false>
 {
 public:
     SegmentTree(const Container& a,
-                const Merge& merge = Merge())
-        : n(a.size()), st(n * 4), f(merge)
+                const Merge& merge = Merge(),
+                int threads = 1)
+        : n(a.size()), st(Layout::size(n)), f(merge)
     {
-        build(0, 0, n - 1, a);
+        build(0, 0, n - 1, a, threads);
     }
 
     template<typename InputIt>
     SegmentTree(InputIt first, InputIt last,
-                const Merge& merge = Merge())
+                const Merge& merge = Merge(),
+                int threads = 1)
         : f(merge)
     {
         Container a(first, last);
         n = a.size();
-        st.resize(n * 4);
-        build(0, 0, n - 1, a);
+        st.resize(Layout::size(n));
+        build(0, 0, n - 1, a, threads);
     }
 
     T query(int i, int j) const { return query(0, 0, n - 1, i, j); }
 
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
+
     void update(int i, const T& v)
     {
         update(0, 0, n - 1, i, v);
     }
 
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        bool has = false;
+        T acc = T();
+        return findFirst(0, 0, n - 1, i, pred, has, acc);
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        bool has = false;
+        T acc = T();
+        return findLast(0, 0, n - 1, j, pred, has, acc);
+    }
+
+    int lowerBoundPrefix(const T& x) const
+    {
+        return findFirst(0, [&x](const T& s) { return !(s < x); });
+    }
+
 private:
-    static int left(int p) { return (p << 1) + 1; }
-    static int right(int p) { return (p << 1) + 2; }
+    static int left(int p) { return Layout::left(p); }
+    static int right(int p) { return Layout::right(p); }
 
-    void build(int p, int L, int R, const Container& a)
+    void build(int p, int L, int R, const Container& a, int threads)
     {
         if (L == R) {
             st[p] = a[L];
         } else {
-            build(left(p), L, (L + R) / 2, a);
-            build(right(p), (L + R) / 2 + 1, R, a);
+            segment_tree_detail::fork_join<T>(threads, R - L + 1,
+                [this, p, L, R, &a](int t) {
+                    build(left(p), L, (L + R) / 2, a, t);
+                },
+                [this, p, L, R, &a](int t) {
+                    build(right(p), (L + R) / 2 + 1, R, a, t);
+                });
             st[p] = f(st[left(p)], st[right(p)]);
         }
     }
@@ -165,7 +476,602 @@ private:
         }
     }
 
+    template<typename Predicate>
+    int findFirst(int p, int L, int R, int i, Predicate& pred,
+                  bool& has, T& acc) const
+    {
+        if (R < i) return -1;
+        if (L >= i) {
+            T v = has ? f(acc, st[p]) : st[p];
+            if (!pred(v)) {
+                acc = v;
+                has = true;
+                return -1;
+            }
+            if (L == R) return L;
+        }
+        int ret = findFirst(left(p), L, (L + R) / 2, i, pred, has, acc);
+        if (ret < 0) {
+            ret = findFirst(right(p), (L + R) / 2 + 1, R, i, pred, has, acc);
+        }
+        return ret;
+    }
+
+    template<typename Predicate>
+    int findLast(int p, int L, int R, int j, Predicate& pred,
+                 bool& has, T& acc) const
+    {
+        if (L > j) return -1;
+        if (R <= j) {
+            T v = has ? f(st[p], acc) : st[p];
+            if (!pred(v)) {
+                acc = v;
+                has = true;
+                return -1;
+            }
+            if (L == R) return L;
+        }
+        int ret = findLast(right(p), (L + R) / 2 + 1, R, j, pred, has, acc);
+        if (ret < 0) {
+            ret = findLast(left(p), L, (L + R) / 2, j, pred, has, acc);
+        }
+        return ret;
+    }
+
     int n;
     std::vector<T> st;
     Merge f;
 };
+
+template<typename T, typename Container, typename Compare, bool cache>
+class SegmentTree<T, Container, Compare, false, SegmentTreeBottomUpLayout,
+                  cache>
+{
+    static_assert(!cache || std::is_trivially_copyable<T>::value,
+                  "cached values require a trivially copyable T");
+
+    typedef segment_tree_detail::comparator_node<T, cache> Node;
+
+public:
+    SegmentTree(const Container& c,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(c), n(a.size()), st(n * 2), f(compare)
+    {
+        build(threads);
+    }
+
+    SegmentTree(Container&& c,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(std::move(c)), n(a.size()), st(n * 2), f(compare)
+    {
+        build(threads);
+    }
+
+    template<typename InputIt>
+    SegmentTree(InputIt first, InputIt last,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(first, last), n(a.size()), st(n * 2), f(compare)
+    {
+        build(threads);
+    }
+
+    int query(int i, int j) const
+    {
+        Node p1 = Node::none(), p2 = Node::none();
+        for (int l = i + n, r = j + n + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) p1 = best(p1, st[l++]);
+            if (r & 1) p2 = best(st[--r], p2);
+        }
+        return best(p1, p2).index;
+    }
+
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
+
+    void update(int i, const T& v)
+    {
+        a[i] = v;
+        update(i);
+    }
+
+    void update(int i, T&& v)
+    {
+        a[i] = std::move(v);
+        update(i);
+    }
+
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        int nodes[64];
+        int k = segment_tree_detail::decompose(n, i, n - 1, nodes);
+        for (int x = 0; x < k; ++x) {
+            int p = nodes[x];
+            if (!pred(st[p].value(a))) continue;
+            while (p < n) {
+                p = pred(st[p << 1].value(a)) ? p << 1 : p << 1 | 1;
+            }
+            return p - n;
+        }
+        return -1;
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        int nodes[64];
+        int k = segment_tree_detail::decompose(n, 0, j, nodes);
+        for (int x = k - 1; x >= 0; --x) {
+            int p = nodes[x];
+            if (!pred(st[p].value(a))) continue;
+            while (p < n) {
+                p = pred(st[p << 1 | 1].value(a)) ? p << 1 | 1 : p << 1;
+            }
+            return p - n;
+        }
+        return -1;
+    }
+
+private:
+    Node best(const Node& p1, const Node& p2) const
+    {
+        if (p1.index < 0) return p2;
+        if (p2.index < 0) return p1;
+        return f(p2.value(a), p1.value(a)) ? p2 : p1;
+    }
+
+    void build(int threads)
+    {
+        for (int i = 0; i < n; ++i) st[n + i] = Node::make(a, i);
+        int b = 1;
+        while ((b << 1) < n) b <<= 1;
+        for (; b > 0; b >>= 1) {
+            segment_tree_detail::parallel_for<Node>(b, std::min(b << 1, n),
+                                                    threads, [this](int p) {
+                st[p] = best(st[p << 1], st[p << 1 | 1]);
+            });
+        }
+    }
+
+    void update(int i)
+    {
+        st[i + n] = Node::make(a, i);
+        for (int p = (i + n) >> 1; p > 0; p >>= 1) {
+            st[p] = best(st[p << 1], st[p << 1 | 1]);
+        }
+    }
+
+    Container a;
+    int n;
+    std::vector<Node> st;
+    Compare f;
+};
+
+template<typename T, typename Container, typename Merge>
+class SegmentTree<T, Container, Merge, true, SegmentTreeBottomUpLayout,
+                  false>
+{
+public:
+    SegmentTree(const Container& a,
+                const Merge& merge = Merge(),
+                int threads = 1)
+        : n(a.size()), st(n * 2), f(merge)
+    {
+        build(a, threads);
+    }
+
+    template<typename InputIt>
+    SegmentTree(InputIt first, InputIt last,
+                const Merge& merge = Merge(),
+                int threads = 1)
+        : f(merge)
+    {
+        Container a(first, last);
+        n = a.size();
+        st.resize(n * 2);
+        build(a, threads);
+    }
+
+    T query(int i, int j) const
+    {
+        bool has1 = false, has2 = false;
+        T v1, v2;
+        for (int l = i + n, r = j + n + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) {
+                v1 = has1 ? f(v1, st[l]) : st[l];
+                has1 = true;
+                ++l;
+            }
+            if (r & 1) {
+                --r;
+                v2 = has2 ? f(st[r], v2) : st[r];
+                has2 = true;
+            }
+        }
+        if (!has1) return v2;
+        if (!has2) return v1;
+        return f(v1, v2);
+    }
+
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
+
+    void update(int i, const T& v)
+    {
+        int p = i + n;
+        st[p] = v;
+        for (p >>= 1; p > 0; p >>= 1) st[p] = f(st[p << 1], st[p << 1 | 1]);
+    }
+
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        int nodes[64];
+        int k = segment_tree_detail::decompose(n, i, n - 1, nodes);
+        bool has = false;
+        T acc = T();
+        for (int x = 0; x < k; ++x) {
+            int p = nodes[x];
+            T v = has ? f(acc, st[p]) : st[p];
+            if (!pred(v)) {
+                acc = v;
+                has = true;
+                continue;
+            }
+            while (p < n) {
+                p <<= 1;
+                v = has ? f(acc, st[p]) : st[p];
+                if (!pred(v)) {
+                    acc = v;
+                    has = true;
+                    p |= 1;
+                }
+            }
+            return p - n;
+        }
+        return -1;
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        int nodes[64];
+        int k = segment_tree_detail::decompose(n, 0, j, nodes);
+        bool has = false;
+        T acc = T();
+        for (int x = k - 1; x >= 0; --x) {
+            int p = nodes[x];
+            T v = has ? f(st[p], acc) : st[p];
+            if (!pred(v)) {
+                acc = v;
+                has = true;
+                continue;
+            }
+            while (p < n) {
+                p = p << 1 | 1;
+                v = has ? f(st[p], acc) : st[p];
+                if (!pred(v)) {
+                    acc = v;
+                    has = true;
+                    p ^= 1;
+                }
+            }
+            return p - n;
+        }
+        return -1;
+    }
+
+    int lowerBoundPrefix(const T& x) const
+    {
+        return findFirst(0, [&x](const T& s) { return !(s < x); });
+    }
+
+private:
+    void build(const Container& a, int threads)
+    {
+        segment_tree_detail::parallel_for<T>(0, n, threads,
+            [this, &a](int i) { st[n + i] = a[i]; });
+        int b = 1;
+        while ((b << 1) < n) b <<= 1;
+        for (; b > 0; b >>= 1) {
+            segment_tree_detail::parallel_for<T>(b, std::min(b << 1, n),
+                                                 threads, [this](int p) {
+                st[p] = f(st[p << 1], st[p << 1 | 1]);
+            });
+        }
+    }
+
+    int n;
+    std::vector<T> st;
+    Merge f;
+};
+
+template<typename T, typename Container, typename Compare, bool cache>
+class SegmentTree<T, Container, Compare, false, SegmentTreeSparseTableLayout,
+                  cache>
+{
+    static_assert(!cache || std::is_trivially_copyable<T>::value,
+                  "cached values require a trivially copyable T");
+
+    typedef segment_tree_detail::comparator_node<T, cache> Node;
+
+public:
+    SegmentTree(const Container& c,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(c), n(a.size()), f(compare)
+    {
+        build(threads);
+    }
+
+    SegmentTree(Container&& c,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(std::move(c)), n(a.size()), f(compare)
+    {
+        build(threads);
+    }
+
+    template<typename InputIt>
+    SegmentTree(InputIt first, InputIt last,
+                const Compare& compare = Compare(),
+                int threads = 1)
+        : a(first, last), n(a.size()), f(compare)
+    {
+        build(threads);
+    }
+
+    int query(int i, int j) const
+    {
+        int k = 31 - __builtin_clz(j - i + 1);
+        return best(level(k)[i], level(k)[j - (1 << k) + 1]).index;
+    }
+
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
+
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        for (int k = st.size() / n - 1; k >= 0; --k) {
+            if (i + (1 << k) <= n && !pred(level(k)[i].value(a))) {
+                i += 1 << k;
+            }
+        }
+        return i < n && pred(a[i]) ? i : -1;
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        for (int k = st.size() / n - 1; k >= 0; --k) {
+            int i = j - (1 << k) + 1;
+            if (i >= 0 && !pred(level(k)[i].value(a))) j -= 1 << k;
+        }
+        return j >= 0 && pred(a[j]) ? j : -1;
+    }
+
+private:
+    Node* level(int k) { return &st[static_cast<std::size_t>(k) * n]; }
+
+    const Node* level(int k) const
+    {
+        return &st[static_cast<std::size_t>(k) * n];
+    }
+
+    const Node& best(const Node& p1, const Node& p2) const
+    {
+        return f(p2.value(a), p1.value(a)) ? p2 : p1;
+    }
+
+    void build(int threads)
+    {
+        int levels = 1;
+        while ((1 << levels) <= n) ++levels;
+        st.resize(static_cast<std::size_t>(levels) * n);
+        for (int i = 0; i < n; ++i) st[i] = Node::make(a, i);
+        for (int k = 1; k < levels; ++k) {
+            segment_tree_detail::parallel_for<Node>(0, n - (1 << k) + 1,
+                                                    threads, [this, k](int i) {
+                level(k)[i] = best(level(k - 1)[i],
+                                   level(k - 1)[i + (1 << (k - 1))]);
+            });
+        }
+    }
+
+    Container a;
+    int n;
+    std::vector<Node> st;
+    Compare f;
+};
+
+template<typename T, typename Container, typename Merge>
+class SegmentTree<T, Container, Merge, true, SegmentTreeSparseTableLayout,
+                  false>;
+
+template<typename T, typename Container, typename Merge>
+class SegmentTree<T, Container, Merge, true, SegmentTreeWideLayout, false>
+{
+    static const int B = sizeof(T) > 4 ? 8 : 16;
+
+public:
+    SegmentTree(const Container& a,
+                const Merge& merge = Merge(),
+                int threads = 1)
+        : n(a.size()), f(merge)
+    {
+        build(a, threads);
+    }
+
+    template<typename InputIt>
+    SegmentTree(InputIt first, InputIt last,
+                const Merge& merge = Merge(),
+                int threads = 1)
+        : f(merge)
+    {
+        Container a(first, last);
+        n = a.size();
+        build(a, threads);
+    }
+
+    T query(int i, int j) const
+    {
+        T acc[B];
+        std::fill(acc, acc + B, id);
+        for (int k = 0; ; ++k) {
+            const T* v = &st[off[k]];
+            int l = (i + B - 1) / B, r = (j + 1) / B;
+            if (l >= r || k + 1 == static_cast<int>(off.size())) {
+                if (i / B == j / B) {
+                    accumulate(acc, v + i / B * B, i % B, j % B);
+                } else {
+                    accumulate(acc, v + i / B * B, i % B, B - 1);
+                    accumulate(acc, v + j / B * B, 0, j % B);
+                }
+                break;
+            }
+            if (i < l * B) accumulate(acc, v + i / B * B, i % B, B - 1);
+            if (j >= r * B) accumulate(acc, v + r * B, 0, j % B);
+            i = l;
+            j = r - 1;
+        }
+        return reduce(acc);
+    }
+
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
+    {
+        return segment_tree_detail::query_batch(*this, first, last, out);
+    }
+
+    template<typename Predicate>
+    int findFirst(int i, Predicate pred) const
+    {
+        T acc = id;
+        int levels = off.size();
+        for (int k = 0; k < levels; ++k) {
+            int size = (k + 1 < levels ? off[k + 1] : st.size()) - off[k];
+            int end = k + 1 < levels ? std::min(size, i / B * B + B) : size;
+            for (; i < end; ++i) {
+                T v = f(acc, st[off[k] + i]);
+                if (pred(v)) {
+                    while (k-- > 0) {
+                        int c = i * B;
+                        for (; c < i * B + B - 1; ++c) {
+                            v = f(acc, st[off[k] + c]);
+                            if (pred(v)) break;
+                            acc = v;
+                        }
+                        i = c;
+                    }
+                    return i;
+                }
+                acc = v;
+            }
+            i /= B;
+        }
+        return -1;
+    }
+
+    template<typename Predicate>
+    int findLast(int j, Predicate pred) const
+    {
+        T acc = id;
+        int levels = off.size();
+        for (int k = 0; k < levels && j >= 0; ++k) {
+            int begin = k + 1 < levels ? j / B * B : 0;
+            for (; j >= begin; --j) {
+                T v = f(st[off[k] + j], acc);
+                if (pred(v)) {
+                    while (k-- > 0) {
+                        int c = j * B + B - 1;
+                        for (; c > j * B; --c) {
+                            v = f(st[off[k] + c], acc);
+                            if (pred(v)) break;
+                            acc = v;
+                        }
+                        j = c;
+                    }
+                    return j;
+                }
+                acc = v;
+            }
+            j = begin / B - 1;
+        }
+        return -1;
+    }
+
+    int lowerBoundPrefix(const T& x) const
+    {
+        return findFirst(0, [&x](const T& s) { return !(s < x); });
+    }
+
+    void update(int i, const T& v)
+    {
+        st[i] = v;
+        for (int k = 1; k < static_cast<int>(off.size()); ++k) {
+            i /= B;
+            st[off[k] + i] = reduce(&st[off[k - 1] + i * B]);
+        }
+    }
+
+private:
+    void accumulate(T* acc, const T* v, int lo, int hi) const
+    {
+        for (int x = 0; x < B; ++x) {
+            T w = v[x];
+            acc[x] = f(acc[x], (x >= lo) & (x <= hi) ? w : id);
+        }
+    }
+
+    T reduce(const T* v) const
+    {
+        T acc[B];
+        std::copy(v, v + B, acc);
+        for (int w = B / 2; w > 0; w /= 2) {
+            for (int x = 0; x < w; ++x) acc[x] = f(acc[x], acc[x + w]);
+        }
+        return acc[0];
+    }
+
+    void build(const Container& a, int threads)
+    {
+        id = SegmentTreeWideTraits<Merge, T>::identity();
+        int m = (n + B - 1) / B * B;
+        off.push_back(0);
+        while (m > B) {
+            off.push_back(off.back() + m);
+            m = (m / B + B - 1) / B * B;
+        }
+        st.assign(off.back() + m, id);
+        segment_tree_detail::parallel_for<T>(0, n, threads,
+            [this, &a](int i) { st[i] = a[i]; });
+        for (int k = 1; k < static_cast<int>(off.size()); ++k) {
+            segment_tree_detail::parallel_for<T>(0, (off[k] - off[k - 1]) / B,
+                                                 threads, [this, k](int i) {
+                st[off[k] + i] = reduce(&st[off[k - 1] + i * B]);
+            });
+        }
+    }
+
+    int n;
+    std::vector<int> off;
+    std::vector<T> st;
+    T id;
+    Merge f;
+};
+
+template<typename T, typename Container, typename Compare, bool cache>
+class SegmentTree<T, Container, Compare, false, SegmentTreeWideLayout, cache>;
@@ -1,308 +1,447 @@
 #include <vector>
+#include <algorithm>
+#include <cstddef>
 #include <functional>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
-template<typename T, typename Container = std::vector<std::vector<T>>,
-         typename Function = std::less<T>, bool merge = false>
-class SegmentTree2D;
+namespace segment_tree_2d_detail {
 
-template<typename T, typename Container, typename Compare>
-class SegmentTree2D<T, Container, Compare, false>
+/* Number of threads to use for elements nodes of type Node: at most one per
+ * 1 << 14 nodes, and only one for bool, as std::vector<bool> packs nodes
+ * into shared words. */
+template<typename Node>
+int workers(int threads, long long elements)
 {
-public:
-    SegmentTree2D(const Container& c,
-                  const Compare& compare = Compare())
-        : a(c),
-          st(a.size() * 4, std::vector<std::pair<int, int>>(a[0].size() * 4)), 
-          f(compare)
-    {
-        build(0, 0, a.size() - 1);
+    if (std::is_same<Node, bool>::value) return 1;
+    return std::max(1LL, std::min<long long>(threads, elements >> 14));
+}
+
+/* Calls f(i) for every row i in [first, last) of width nodes on up to
+ * workers() threads, each handling a contiguous chunk of rows. */
+template<typename Node, typename F>
+void parallel_for(int first, int last, int width, int threads, F f)
+{
+    threads = workers<Node>(threads,
+                            static_cast<long long>(last - first) * width);
+    int chunk = (last - first + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        int b = first + t * chunk, e = std::min(last, b + chunk);
+        pool.emplace_back([b, e, &f] { for (int i = b; i < e; ++i) f(i); });
     }
+    for (int i = first; i < std::min(last, first + chunk); ++i) f(i);
+    for (auto& t : pool) t.join();
+}
 
-    SegmentTree2D(Container&& c,
-                  const Compare& compare = Compare())
-        : a(std::move(c)),
-          st(a.size() * 4, std::vector<std::pair<int, int>>(a[0].size() * 4)), 
-          f(compare)
+/* Node of a comparator tree: the index of the best cell and, when cached, a
+ * copy of its value so comparisons do not go back to the grid. */
+template<typename T, bool cache>
+struct comparator_node
+{
+    static comparator_node none()
     {
-        build(0, 0, a.size() - 1);
+        comparator_node n = comparator_node();
+        n.index = -1;
+        return n;
     }
 
-    std::pair<int, int> query(int x1, int y1, int x2, int y2) const
+    static comparator_node make(const std::vector<T>& v, int i)
     {
-        return query(0, 0, a.size() - 1, x1, y1, x2, y2);
+        comparator_node n;
+        n.index = i;
+        n.cached = v[i];
+        return n;
     }
 
-    void update(int x, int y, const T& v)
+    const T& value(const std::vector<T>&) const { return cached; }
+
+    int index;
+    T cached;
+};
+
+template<typename T>
+struct comparator_node<T, false>
+{
+    static comparator_node none()
     {
-        a[y][x] = v;
-        update(0, 0, a.size() - 1, x, y);
+        comparator_node n;
+        n.index = -1;
+        return n;
     }
 
-    void update(int x, int y, T&& v)
+    static comparator_node make(const std::vector<T>&, int i)
     {
-        a[y][x] = std::move(v);
-        update(0, 0, a.size() - 1, x, y);
+        comparator_node n;
+        n.index = i;
+        return n;
     }
 
-private:
-    static int left(int p) { return (p << 1) + 1; }
-    static int right(int p) { return (p << 1) + 2; }
+    typename std::vector<T>::const_reference
+    value(const std::vector<T>& v) const { return v[index]; }
 
-    void build(int p, int L, int R)
-    {
-        if (L == R) {
-            build(st[p], 0, 0, a[0].size() - 1, L, a[L]);
-        } else {
-            build(left(p), L, (L + R) / 2);
-            build(right(p), (L + R) / 2 + 1, R);
-            buildMerge(st[p], st[left(p)], st[right(p)], 0, 0, a[0].size() - 1);
+    int index;
+};
+
+struct BatchTask
+{
+    int x1;
+    int x2;
+    int slot;
+};
+
+/* Stores the row-tree nodes covering [y1, y2] in top-to-bottom order and
+ * returns their count (at most 64). */
+inline int decompose(int ny, int y1, int y2, int* nodes)
+{
+    int k = 0, m = 64;
+    for (int l = y1 + ny, r = y2 + ny + 1; l < r; l >>= 1, r >>= 1) {
+        if (l & 1) nodes[k++] = l++;
+        if (r & 1) nodes[--m] = --r;
+    }
+    return std::copy(nodes + m, nodes + 64, nodes + k) - nodes;
+}
+
+/* Splits each (x1, y1, x2, y2) rectangle into one task per row-tree node of
+ * its y decomposition and returns the tasks grouped by row tree (counting
+ * sort on the row), those of row py being [begin[py], begin[py + 1]). The
+ * tasks of rectangle q write their results to slots [start[q], start[q + 1])
+ * in top-to-bottom order. */
+template<typename InputIt>
+std::vector<BatchTask> batch_tasks(int ny, InputIt first, InputIt last,
+                                   std::vector<int>& start,
+                                   std::vector<int>& begin)
+{
+    std::vector<int> rect;
+    start.assign(1, 0);
+    begin.assign(ny * 2 + 1, 0);
+    for (; first != last; ++first) {
+        int y1 = std::get<1>(*first), y2 = std::get<3>(*first);
+        rect.push_back(std::get<0>(*first));
+        rect.push_back(y1);
+        rect.push_back(std::get<2>(*first));
+        rect.push_back(y2);
+        int nodes[64], k = decompose(ny, y1, y2, nodes);
+        for (int i = 0; i < k; ++i) ++begin[nodes[i] + 1];
+        start.push_back(start.back() + k);
+    }
+    for (int py = 1; py <= ny * 2; ++py) begin[py] += begin[py - 1];
+    std::vector<int> next(begin.begin(), begin.end() - 1);
+    std::vector<BatchTask> tasks(start.back());
+    for (int q = 0; q + 1 < static_cast<int>(start.size()); ++q) {
+        const int* r = &rect[q * 4];
+        int nodes[64], k = decompose(ny, r[1], r[3], nodes);
+        for (int i = 0; i < k; ++i) {
+            tasks[next[nodes[i]]++] = {r[0], r[2], start[q] + i};
         }
     }
+    return tasks;
+}
+
+} // namespace segment_tree_2d_detail
+
+/* Iterative bottom-up segment tree of bottom-up segment trees, stored in one
+ * contiguous array of 2ny rows of 2nx nodes with leaves at [ny, 2ny) x
+ * [nx, 2nx). The comparator version keeps a flat copy of the grid and stores
+ * the row-major index of the best cell in each node, along with a copy of
+ * its value when cache is set (T must then be trivially copyable). Among
+ * equally good cells it returns the first in row-major order. */
+template<typename T, typename Container = std::vector<std::vector<T>>,
+         typename Function = std::less<T>, bool merge = false,
+         bool cache = false>
+class SegmentTree2D;
+
+template<typename T, typename Container, typename Compare, bool cache>
+class SegmentTree2D<T, Container, Compare, false, cache>
+{
+    static_assert(!cache || std::is_trivially_copyable<T>::value,
+                  "cached values require a trivially copyable T");
+
+    typedef segment_tree_2d_detail::comparator_node<T, cache> Node;
 
-    void build(std::vector<std::pair<int, int>>& str,
-               int p, int L, int R, int y,
-               const typename Container::value_type& ar)
+public:
+    SegmentTree2D(const Container& a,
+                  const Compare& compare = Compare(),
+                  int threads = 1)
+        : nx(a[0].size()), ny(a.size()),
+          v(static_cast<std::size_t>(nx) * ny),
+          st(static_cast<std::size_t>(nx) * ny * 4), f(compare)
     {
-        if (L == R) {
-            str[p] = {L, y};
-        } else {
-            build(str, left(p), L, (L + R) / 2, y, ar);
-            build(str, right(p), (L + R) / 2 + 1, R, y, ar);
-            auto p1 = str[left(p)], p2 = str[right(p)];
-            str[p] = f(ar[p2.first], ar[p1.first]) ? p2 : p1;
+        for (int y = 0; y < ny; ++y) {
+            for (int x = 0; x < nx; ++x) v[index(x, y)] = a[y][x];
         }
+        build(threads);
     }
 
-    void buildMerge(std::vector<std::pair<int, int>>& str,
-                    const std::vector<std::pair<int, int>>& strl,
-                    const std::vector<std::pair<int, int>>& strr,
-                    int p, int L, int R)
+    std::pair<int, int> query(int x1, int y1, int x2, int y2) const
     {
-        if (L != R) {
-            buildMerge(str, strl, strr, left(p), L, (L + R) / 2);
-            buildMerge(str, strl, strr, right(p), (L + R) / 2 + 1, R);
+        Node p1 = Node::none(), p2 = Node::none();
+        for (int l = y1 + ny, r = y2 + ny + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) p1 = best(p1, query(l++, x1, x2));
+            if (r & 1) p2 = best(query(--r, x1, x2), p2);
         }
-        str[p] = f(a[strr[p].second][strr[p].first],
-                   a[strl[p].second][strl[p].first]) ? strr[p] : strl[p];
+        int p = best(p1, p2).index;
+        return {p % nx, p / nx};
     }
 
-    std::pair<int, int> query(int p, int L, int R,
-                              int x1, int y1, int x2, int y2) const
+    /* Answers a batch of (x1, y1, x2, y2) rectangles, visiting each row
+     * tree once for all rectangles that use it. */
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
     {
-        if (L >= y1 && R <= y2) {
-            return query(st[p], 0, 0, a[0].size() - 1, x1, x2);
+        std::vector<int> start, begin;
+        std::vector<segment_tree_2d_detail::BatchTask> tasks =
+            segment_tree_2d_detail::batch_tasks(ny, first, last, start, begin);
+        std::vector<Node> part(tasks.size());
+        for (int py = 1; py < ny * 2; ++py) {
+            for (int i = begin[py]; i < begin[py + 1]; ++i) {
+                part[tasks[i].slot] = query(py, tasks[i].x1, tasks[i].x2);
+            }
         }
-        if (y2 < (L + R) / 2 + 1) {
-            return query(left(p), L, (L + R) / 2, x1, y1, x2, y2);
-        } else if (y1 > (L + R) / 2) {
-            return query(right(p), (L + R) / 2 + 1, R, x1, y1, x2, y2);
-        } else {
-            auto p1 = query(left(p), L, (L + R) / 2, x1, y1, x2, y2);
-            auto p2 = query(right(p), (L + R) / 2 + 1, R, x1, y1, x2, y2);
-            return f(a[p2.second][p2.first], a[p1.second][p1.first]) ? p2 : p1;
+        for (int q = 0; q + 1 < static_cast<int>(start.size()); ++q) {
+            Node p = Node::none();
+            for (int i = start[q]; i < start[q + 1]; ++i) p = best(p, part[i]);
+            *out++ = std::make_pair(p.index % nx, p.index / nx);
         }
+        return out;
     }
 
-    std::pair<int, int> query(const std::vector<std::pair<int, int>>& str,
-                              int p, int L, int R, int x1, int x2) const
+    void update(int x, int y, const T& val)
     {
-        if (L >= x1 && R <= x2) return str[p];
-        if (x2 < (L + R) / 2 + 1) {
-            return query(str, left(p), L, (L + R) / 2, x1, x2);
-        } else if (x1 > (L + R) / 2) {
-            return query(str, right(p), (L + R) / 2 + 1, R, x1, x2);
-        } else {
-            auto p1 = query(str, left(p), L, (L + R) / 2, x1, x2);
-            auto p2 = query(str, right(p), (L + R) / 2 + 1, R, x1, x2);
-            return f(a[p2.second][p2.first], a[p1.second][p1.first]) ? p2 : p1;
+        v[index(x, y)] = val;
+        update(x, y);
+    }
+
+    void update(int x, int y, T&& val)
+    {
+        v[index(x, y)] = std::move(val);
+        update(x, y);
+    }
+
+private:
+    int index(int x, int y) const { return y * nx + x; }
+
+    Node* row(int py) { return &st[static_cast<std::size_t>(py) * nx * 2]; }
+
+    const Node* row(int py) const
+    {
+        return &st[static_cast<std::size_t>(py) * nx * 2];
+    }
+
+    /* Prefers p1 on ties: callers pass first the node whose cells all come
+     * earlier in row-major order. */
+    Node best(const Node& p1, const Node& p2) const
+    {
+        if (p1.index < 0) return p2;
+        if (p2.index < 0) return p1;
+        return f(p2.value(v), p1.value(v)) ? p2 : p1;
+    }
+
+    /* Like best(), but for nodes over the same rows, where the first node's
+     * cell may come later in row-major order. */
+    Node lowest(const Node& p1, const Node& p2) const
+    {
+        if (p1.index < 0) return p2;
+        if (p2.index < 0) return p1;
+        bool second = f(p2.value(v), p1.value(v));
+        if (!(second | f(p1.value(v), p2.value(v)))) {
+            second = p2.index < p1.index;
         }
+        return second ? p2 : p1;
     }
 
-    void update(int p, int L, int R, int x, int y)
+    Node query(int py, int x1, int x2) const
     {
-        if (L == R) {
-            update(st[p], 0, 0, a[0].size() - 1, x, a[L]);
-        } else {
-            if (y > (L + R) / 2) {
-                update(right(p), (L + R) / 2 + 1, R, x, y);
-            } else {
-                update(left(p), L, (L + R) / 2, x, y);
-            }
-            updateMerge(st[p], st[left(p)], st[right(p)],
-                        0, 0, a[0].size() - 1, x);
+        const Node* s = row(py);
+        Node p1 = Node::none(), p2 = Node::none();
+        for (int l = x1 + nx, r = x2 + nx + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) p1 = lowest(p1, s[l++]);
+            if (r & 1) p2 = lowest(s[--r], p2);
         }
+        return lowest(p1, p2);
     }
 
-    void update(std::vector<std::pair<int, int>>& str,
-                int p, int L, int R, int x,
-                const typename Container::value_type& ar)
+    void build(int threads)
     {
-        if (L != R) {
-            if (x > (L + R) / 2) {
-                update(str, right(p), (L + R) / 2 + 1, R, x, ar);
-            } else {
-                update(str, left(p), L, (L + R) / 2, x, ar);
-            }
-            auto p1 = str[left(p)], p2 = str[right(p)];
-            str[p] = f(ar[p2.first], ar[p1.first]) ? p2 : p1;
+        segment_tree_2d_detail::parallel_for<Node>(ny, ny * 2, nx * 2, threads,
+            [this](int py) {
+                Node* s = row(py);
+                for (int x = 0; x < nx; ++x) {
+                    s[nx + x] = Node::make(v, index(x, py - ny));
+                }
+                for (int px = nx - 1; px > 0; --px) {
+                    s[px] = best(s[px << 1], s[px << 1 | 1]);
+                }
+            });
+        int b = 1;
+        while ((b << 1) < ny) b <<= 1;
+        for (; b > 0; b >>= 1) {
+            segment_tree_2d_detail::parallel_for<Node>(b, std::min(b << 1, ny),
+                                                       nx * 2, threads,
+                                                       [this](int py) {
+                Node* s = row(py);
+                const Node* sl = row(py << 1);
+                const Node* sr = row(py << 1 | 1);
+                for (int px = 1; px < nx * 2; ++px) {
+                    s[px] = best(sl[px], sr[px]);
+                }
+            });
         }
     }
 
-    void updateMerge(std::vector<std::pair<int, int>>& str,
-                     const std::vector<std::pair<int, int>>& strl,
-                     const std::vector<std::pair<int, int>>& strr,
-                     int p, int L, int R, int x)
+    void update(int x, int y)
     {
-        if (L != R) {
-            if (x > (L + R) / 2) {
-                updateMerge(str, strl, strr, right(p), (L + R) / 2 + 1, R, x);
-            } else {
-                updateMerge(str, strl, strr, left(p), L, (L + R) / 2, x);
+        Node* s = row(y + ny);
+        s[x + nx] = Node::make(v, index(x, y));
+        for (int px = (x + nx) >> 1; px > 0; px >>= 1) {
+            s[px] = best(s[px << 1], s[px << 1 | 1]);
+        }
+        for (int py = (y + ny) >> 1; py > 0; py >>= 1) {
+            s = row(py);
+            const Node* sl = row(py << 1);
+            const Node* sr = row(py << 1 | 1);
+            for (int px = x + nx; px > 0; px >>= 1) {
+                s[px] = best(sl[px], sr[px]);
             }
         }
-        str[p] = f(a[strr[p].second][strr[p].first],
-                   a[strl[p].second][strl[p].first]) ? strr[p] : strl[p];
     }
 
-    Container a;
-    std::vector<std::vector<std::pair<int, int>>> st;
+    int nx, ny;
+    std::vector<T> v;
+    std::vector<Node> st;
     Compare f;
 };
 
 template<typename T, typename Container, typename Merge>
-class SegmentTree2D<T, Container, Merge, true>
+class SegmentTree2D<T, Container, Merge, true, false>
 {
 public:
     SegmentTree2D(const Container& a,
-                  const Merge& merge = Merge())
-        : nx(a[0].size()), ny(a.size()), st(ny * 4, std::vector<T>(nx * 4)),
-          f(merge)
+                  const Merge& merge = Merge(),
+                  int threads = 1)
+        : nx(a[0].size()), ny(a.size()),
+          st(static_cast<std::size_t>(nx) * ny * 4), f(merge)
     {
-        build(0, 0, ny - 1, a);
+        build(a, threads);
     }
 
     T query(int x1, int y1, int x2, int y2) const
     {
-        return query(0, 0, ny - 1, x1, y1, x2, y2);
-    }
-
-    void update(int x, int y, const T& v)
-    {
-        update(0, 0, ny - 1, x, y, v);
-    }
-
-private:
-    static int left(int p) { return (p << 1) + 1; }
-    static int right(int p) { return (p << 1) + 2; }
-
-    void build(int p, int L, int R, const Container& a)
-    {
-        if (L == R) {
-            build(st[p], 0, 0, nx - 1, a[L]);
-        } else {
-            build(left(p), L, (L + R) / 2, a);
-            build(right(p), (L + R) / 2 + 1, R, a);
-            buildMerge(st[p], st[left(p)], st[right(p)], 0, 0, nx - 1);
+        bool has1 = false, has2 = false;
+        T v1 = T(), v2 = T();
+        for (int l = y1 + ny, r = y2 + ny + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) {
+                T v = query(l++, x1, x2);
+                v1 = has1 ? f(v1, v) : v;
+                has1 = true;
+            }
+            if (r & 1) {
+                T v = query(--r, x1, x2);
+                v2 = has2 ? f(v, v2) : v;
+                has2 = true;
+            }
         }
+        if (!has1) return v2;
+        if (!has2) return v1;
+        return f(v1, v2);
     }
 
-    void build(std::vector<T>& str, int p, int L, int R,
-               const typename Container::value_type& ar)
+    /* Answers a batch of (x1, y1, x2, y2) rectangles, visiting each row
+     * tree once for all rectangles that use it. */
+    template<typename InputIt, typename OutputIt>
+    OutputIt queryBatch(InputIt first, InputIt last, OutputIt out) const
     {
-        if (L == R) {
-            str[p] = ar[L];
-        } else {
-            build(str, left(p), L, (L + R) / 2, ar);
-            build(str, right(p), (L + R) / 2 + 1, R, ar);
-            str[p] = f(str[left(p)], str[right(p)]);
+        std::vector<int> start, begin;
+        std::vector<segment_tree_2d_detail::BatchTask> tasks =
+            segment_tree_2d_detail::batch_tasks(ny, first, last, start, begin);
+        std::vector<T> part(tasks.size());
+        for (int py = 1; py < ny * 2; ++py) {
+            for (int i = begin[py]; i < begin[py + 1]; ++i) {
+                part[tasks[i].slot] = query(py, tasks[i].x1, tasks[i].x2);
+            }
         }
-    }
-
-    void buildMerge(std::vector<T>& str,
-                    const std::vector<T>& strl, const std::vector<T>& strr,
-                    int p, int L, int R)
-    {
-        if (L != R) {
-            buildMerge(str, strl, strr, left(p), L, (L + R) / 2);
-            buildMerge(str, strl, strr, right(p), (L + R) / 2 + 1, R);
+        for (int q = 0; q + 1 < static_cast<int>(start.size()); ++q) {
+            T v = part[start[q]];
+            for (int i = start[q] + 1; i < start[q + 1]; ++i) v = f(v, part[i]);
+            *out++ = v;
         }
-        str[p] = f(strl[p], strr[p]);
+        return out;
     }
 
-    T query(int p, int L, int R, int x1, int y1, int x2, int y2) const
+    void update(int x, int y, const T& v)
     {
-        if (L >= y1 && R <= y2) {
-            return query(st[p], 0, 0, nx - 1, x1, x2);
+        std::size_t s = row(y + ny);
+        st[s + x + nx] = v;
+        for (int px = (x + nx) >> 1; px > 0; px >>= 1) {
+            st[s + px] = f(st[s + (px << 1)], st[s + (px << 1 | 1)]);
         }
-        if (y2 < (L + R) / 2 + 1) {
-            return query(left(p), L, (L + R) / 2, x1, y1, x2, y2);
-        } else if (y1 > (L + R) / 2) {
-            return query(right(p), (L + R) / 2 + 1, R, x1, y1, x2, y2);
-        } else {
-            return f(query(left(p), L, (L + R) / 2, x1, y1, x2, y2),
-                     query(right(p), (L + R) / 2 + 1, R, x1, y1, x2, y2));
+        for (int py = (y + ny) >> 1; py > 0; py >>= 1) {
+            s = row(py);
+            std::size_t sl = row(py << 1), sr = row(py << 1 | 1);
+            for (int px = x + nx; px > 0; px >>= 1) {
+                st[s + px] = f(st[sl + px], st[sr + px]);
+            }
         }
     }
 
-    T query(const std::vector<T>& str,
-            int p, int L, int R, int x1, int x2) const
+private:
+    /* Offset of row py in st; rows are indexed rather than handed out as
+     * T* so that std::vector<bool> storage works. */
+    std::size_t row(int py) const
     {
-        if (L >= x1 && R <= x2) return str[p];
-        if (x2 < (L + R) / 2 + 1) {
-            return query(str, left(p), L, (L + R) / 2, x1, x2);
-        } else if (x1 > (L + R) / 2) {
-            return query(str, right(p), (L + R) / 2 + 1, R, x1, x2);
-        } else {
-            return f(query(str, left(p), L, (L + R) / 2, x1, x2),
-                     query(str, right(p), (L + R) / 2 + 1, R, x1, x2));
-        }
+        return static_cast<std::size_t>(py) * nx * 2;
     }
 
-    void update(int p, int L, int R, int x, int y, const T& v)
+    T query(int py, int x1, int x2) const
     {
-        if (L == R) {
-            update(st[p], 0, 0, nx - 1, x, v);
-        } else {
-            if (y > (L + R) / 2) {
-                update(right(p), (L + R) / 2 + 1, R, x, y, v);
-            } else {
-                update(left(p), L, (L + R) / 2, x, y, v);
+        std::size_t s = row(py);
+        bool has1 = false, has2 = false;
+        T v1 = T(), v2 = T();
+        for (int l = x1 + nx, r = x2 + nx + 1; l < r; l >>= 1, r >>= 1) {
+            if (l & 1) {
+                v1 = has1 ? f(v1, st[s + l]) : st[s + l];
+                has1 = true;
+                ++l;
             }
-            updateMerge(st[p], st[left(p)], st[right(p)],
-                        0, 0, nx - 1, x);
-        }
-    }
-
-    void update(std::vector<T>& str, int p, int L, int R, int x, const T& v)
-    {
-        if (L == R) {
-            str[p] = v;
-        } else {
-            if (x > (L + R) / 2) {
-                update(str, right(p), (L + R) / 2 + 1, R, x, v);
-            } else {
-                update(str, left(p), L, (L + R) / 2, x, v);
+            if (r & 1) {
+                --r;
+                v2 = has2 ? f(st[s + r], v2) : st[s + r];
+                has2 = true;
             }
-            str[p] = f(str[left(p)], str[right(p)]);
         }
+        if (!has1) return v2;
+        if (!has2) return v1;
+        return f(v1, v2);
     }
 
-    void updateMerge(std::vector<T>& str,
-                     const std::vector<T>& strl, const std::vector<T>& strr,
-                     int p, int L, int R, int x)
+    void build(const Container& a, int threads)
     {
-        if (L != R) {
-            if (x > (L + R) / 2) {
-                updateMerge(str, strl, strr, right(p), (L + R) / 2 + 1, R, x);
-            } else {
-                updateMerge(str, strl, strr, left(p), L, (L + R) / 2, x);
-            }
+        segment_tree_2d_detail::parallel_for<T>(ny, ny * 2, nx * 2, threads,
+            [this, &a](int py) {
+                std::size_t s = row(py);
+                for (int x = 0; x < nx; ++x) st[s + nx + x] = a[py - ny][x];
+                for (int px = nx - 1; px > 0; --px) {
+                    st[s + px] = f(st[s + (px << 1)], st[s + (px << 1 | 1)]);
+                }
+            });
+        int b = 1;
+        while ((b << 1) < ny) b <<= 1;
+        for (; b > 0; b >>= 1) {
+            segment_tree_2d_detail::parallel_for<T>(b, std::min(b << 1, ny),
+                                                    nx * 2, threads,
+                                                    [this](int py) {
+                std::size_t s = row(py);
+                std::size_t sl = row(py << 1), sr = row(py << 1 | 1);
+                for (int px = 1; px < nx * 2; ++px) {
+                    st[s + px] = f(st[sl + px], st[sr + px]);
+                }
+            });
         }
-        str[p] = f(strl[p], strr[p]);
     }
 
     int nx, ny;
-    std::vector<std::vector<T>> st;
+    std::vector<T> st;
     Merge f;
 };
@@ -0,0 +1,77 @@
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+/* Immutable 2D sparse table answering comparator queries over rectangles in
+ * O(1) with four overlapping power-of-two windows. Level (kx, ky) stores the
+ * row-major index of the best cell of every 2^kx by 2^ky window, so memory is
+ * nx * ny * (lg nx + 1) * (lg ny + 1) ints. */
+template<typename T, typename Container = std::vector<std::vector<T>>,
+         typename Compare = std::less<T>>
+class SparseTable2D
+{
+public:
+    SparseTable2D(const Container& a, const Compare& compare = Compare())
+        : nx(a[0].size()), ny(a.size()),
+          v(static_cast<std::size_t>(nx) * ny), f(compare)
+    {
+        for (int y = 0; y < ny; ++y) {
+            for (int x = 0; x < nx; ++x) v[y * nx + x] = a[y][x];
+        }
+        build();
+    }
+
+    std::pair<int, int> query(int x1, int y1, int x2, int y2) const
+    {
+        int kx = 31 - __builtin_clz(x2 - x1 + 1);
+        int ky = 31 - __builtin_clz(y2 - y1 + 1);
+        const int* s = level(kx, ky);
+        int x3 = x2 - (1 << kx) + 1, y3 = y2 - (1 << ky) + 1;
+        int p = best(best(s[y1 * nx + x1], s[y1 * nx + x3]),
+                     best(s[y3 * nx + x1], s[y3 * nx + x3]));
+        return {p % nx, p / nx};
+    }
+
+private:
+    int* level(int kx, int ky)
+    {
+        return &st[(static_cast<std::size_t>(ky) * lx + kx) * nx * ny];
+    }
+
+    const int* level(int kx, int ky) const
+    {
+        return &st[(static_cast<std::size_t>(ky) * lx + kx) * nx * ny];
+    }
+
+    int best(int p1, int p2) const { return f(v[p2], v[p1]) ? p2 : p1; }
+
+    void build()
+    {
+        lx = 1;
+        while ((1 << lx) <= nx) ++lx;
+        int ly = 1;
+        while ((1 << ly) <= ny) ++ly;
+        st.resize(static_cast<std::size_t>(lx) * ly * nx * ny);
+        for (int i = 0; i < nx * ny; ++i) st[i] = i;
+        for (int ky = 0; ky < ly; ++ky) {
+            for (int kx = ky ? 0 : 1; kx < lx; ++kx) {
+                int* s = level(kx, ky);
+                int w = 1 << kx, h = 1 << ky;
+                const int* t = ky ? level(kx, ky - 1) : level(kx - 1, 0);
+                int d = ky ? h / 2 * nx : w / 2;
+                for (int y = 0; y + h <= ny; ++y) {
+                    for (int x = 0; x + w <= nx; ++x) {
+                        int i = y * nx + x;
+                        s[i] = best(t[i], t[i + d]);
+                    }
+                }
+            }
+        }
+    }
+
+    int nx, ny, lx;
+    std::vector<T> v;
+    std::vector<int> st;
+    Compare f;
+};